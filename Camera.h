@@ -108,6 +108,16 @@ public:
         this->updateCameraVectors();
     }
 
+    // Places the camera at position and turns it towards target. Used by scripted camera paths.
+    void LookAt(glm::vec3 position, glm::vec3 target)
+    {
+        glm::vec3 direction = glm::normalize(target - position);
+        this->Position = position;
+        this->Yaw = glm::degrees(atan2(direction.z, direction.x));
+        this->Pitch = glm::degrees(asin(direction.y));
+        this->updateCameraVectors();
+    }
+
     // Processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
     void ProcessMouseScroll(GLfloat yoffset)
     {
@@ -0,0 +1,133 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+
+// Signed distance fields from coverage bitmaps, for resolution independent
+// glyph rendering. The source bitmap is rasterized at upsample times the
+// output resolution; the 8SSEDT distance transform runs at that resolution
+// and is box filtered down. Output bytes map distances in [-spread, spread]
+// output pixels to [0, 255] with the edge at 128, positive inside.
+namespace DistanceField
+{
+    // Offset to the nearest seed pixel, large while none has been found
+    struct SeedOffset {
+        int dx, dy;
+        int DistSq() const { return dx * dx + dy * dy; }
+    };
+
+    inline void Compare(vector<SeedOffset> &grid, int width, int x, int y,
+                        int offsetX, int offsetY, SeedOffset &p)
+    {
+        SeedOffset other = grid[(y + offsetY) * width + x + offsetX];
+        other.dx += offsetX;
+        other.dy += offsetY;
+        if(other.DistSq() < p.DistSq())
+            p = other;
+    }
+
+    // Two pass 8-point sequential Euclidean distance transform. The grid
+    // has a one pixel border that is never written, so neighbours need no
+    // bounds checks.
+    inline void Transform(vector<SeedOffset> &grid, int width, int height)
+    {
+        for(int y = 1; y < height - 1; y++)
+        {
+            for(int x = 1; x < width - 1; x++)
+            {
+                SeedOffset p = grid[y * width + x];
+                Compare(grid, width, x, y, -1,  0, p);
+                Compare(grid, width, x, y,  0, -1, p);
+                Compare(grid, width, x, y, -1, -1, p);
+                Compare(grid, width, x, y,  1, -1, p);
+                grid[y * width + x] = p;
+            }
+            for(int x = width - 2; x >= 1; x--)
+            {
+                SeedOffset p = grid[y * width + x];
+                Compare(grid, width, x, y, 1, 0, p);
+                grid[y * width + x] = p;
+            }
+        }
+        for(int y = height - 2; y >= 1; y--)
+        {
+            for(int x = width - 2; x >= 1; x--)
+            {
+                SeedOffset p = grid[y * width + x];
+                Compare(grid, width, x, y,  1,  0, p);
+                Compare(grid, width, x, y,  0,  1, p);
+                Compare(grid, width, x, y, -1,  1, p);
+                Compare(grid, width, x, y,  1,  1, p);
+                grid[y * width + x] = p;
+            }
+            for(int x = 1; x < width - 1; x++)
+            {
+                SeedOffset p = grid[y * width + x];
+                Compare(grid, width, x, y, -1, 0, p);
+                grid[y * width + x] = p;
+            }
+        }
+    }
+
+    // Builds the field of a coverage bitmap. The bitmap is placed at
+    // (offsetX, offsetY) in a hi-res grid of (outWidth, outHeight) * upsample
+    // pixels; the caller picks the offsets so the glyph is surrounded by at
+    // least spread output pixels of empty space. out receives
+    // outWidth * outHeight bytes.
+    inline void Generate(const GLubyte *bitmap, int width, int rows, int pitch,
+                         int offsetX, int offsetY, int outWidth, int outHeight,
+                         int upsample, int spread, vector<GLubyte> &out)
+    {
+        int gridWidth = outWidth * upsample + 2;
+        int gridHeight = outHeight * upsample + 2;
+        const SeedOffset empty = { 9999, 9999 };
+        const SeedOffset seed = { 0, 0 };
+
+        // inside holds the distance to the nearest covered pixel, outside
+        // to the nearest uncovered one
+        vector<SeedOffset> inside(gridWidth * gridHeight, empty);
+        vector<SeedOffset> outside(gridWidth * gridHeight, seed);
+        for(int y = 0; y < rows; y++)
+        {
+            for(int x = 0; x < width; x++)
+            {
+                if(bitmap[y * pitch + x] < 128)
+                    continue;
+                int index = (y + offsetY + 1) * gridWidth + x + offsetX + 1;
+                inside[index] = seed;
+                outside[index] = empty;
+            }
+        }
+        Transform(inside, gridWidth, gridHeight);
+        Transform(outside, gridWidth, gridHeight);
+
+        out.assign(outWidth * outHeight, 0);
+        float toByte = 127.0f / (spread * upsample * upsample * upsample);
+        for(int oy = 0; oy < outHeight; oy++)
+        {
+            for(int ox = 0; ox < outWidth; ox++)
+            {
+                // Sum of the hi-res distances under this output pixel
+                float sum = 0.0f;
+                for(int sy = 0; sy < upsample; sy++)
+                {
+                    for(int sx = 0; sx < upsample; sx++)
+                    {
+                        int index = (oy * upsample + sy + 1) * gridWidth + ox * upsample + sx + 1;
+                        // Seeds are pixel centres, the edge lies half a pixel further out
+                        if(inside[index].DistSq() == 0)
+                            sum += sqrtf((float)outside[index].DistSq()) - 0.5f;
+                        else
+                            sum -= sqrtf((float)inside[index].DistSq()) - 0.5f;
+                    }
+                }
+                float value = 128.0f + sum * toByte;
+                out[oy * outWidth + ox] = (GLubyte)max(0.0f, min(255.0f, value));
+            }
+        }
+    }
+}
@@ -5,12 +5,15 @@
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <utility>
 using namespace std;
 // GL Includes
 #include <GL/glew.h> // Contains all the necessery OpenGL includes
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "vertexpacking.h"
+
 
 struct Vertex {
     // Position
@@ -21,6 +24,14 @@ struct Vertex {
     glm::vec2 TexCoords;
 };
 
+// Per-instance data for instanced draws. The model matrix feeds attribute
+// locations 3-6 and the material index location 7.
+struct InstanceData {
+    glm::mat4 Model;
+    GLuint Material;
+    GLuint Padding[3];
+};
+
 struct Texture {
     GLuint id;
     string type;
@@ -35,84 +46,179 @@ public:
     vector<Texture> textures;
 
     /*  Functions  */
-    // Constructor
+    // Constructor. Pass the vectors with std::move to hand them over without a copy.
     Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->textures = std::move(textures);
+        this->setupSamplerNames();
 
         // Now that we have all the required data, set the vertex buffers and its attribute pointers.
-        this->setupMesh();
+        this->setupMesh(&this->vertices[0], this->vertices.size(),
+                        &this->indices[0], this->indices.size());
+    }
+
+    // Constructor for data that is already in buffer layout, e.g. a mapped
+    // mesh cache. The arrays are uploaded as they are and no CPU copy is kept,
+    // so vertices and indices stay empty.
+    Mesh(const Vertex *vertices, GLsizei numVertices, const GLuint *indices,
+         GLsizei numIndices, vector<Texture> textures)
+    {
+        this->textures = std::move(textures);
+        this->setupSamplerNames();
+        this->setupMesh(vertices, numVertices, indices, numIndices);
+    }
+
+    // Frees the CPU copies of the vertices and indices. The GL buffers keep
+    // everything needed to draw.
+    void releaseMeshData()
+    {
+        vector<Vertex>().swap(this->vertices);
+        vector<GLuint>().swap(this->indices);
     }
 
     // Render the mesh
     void Draw(GLSLProgram &shader, bool shadow = false)
+    {
+        this->DrawInstanced(shader, 1, shadow);
+    }
+
+    // Render instanceCount copies of the mesh in one draw call, reading the
+    // per-instance attributes from baseInstance on. Requires
+    // setInstanceBuffer() unless instanceCount is 1.
+    void DrawInstanced(GLSLProgram &shader, GLsizei instanceCount, bool shadow = false,
+                       GLuint baseInstance = 0)
     {
 
         if(!shadow)
         {
             // Bind appropriate textures
-            GLuint diffuseNr = 1;
-            GLuint specularNr = 1;
             for(GLuint i = 0; i < this->textures.size(); i++)
             {
                 glActiveTexture(GL_TEXTURE0 + i); // Active proper texture unit before binding
-                // Retrieve texture number (the N in diffuse_textureN)
-                stringstream ss;
-                string number;
-                string name = this->textures[i].type;
-                if(name == "texture_diffuse")
-                    ss << diffuseNr++; // Transfer GLuint to stream
-                else if(name == "texture_specular")
-                    ss << specularNr++; // Transfer GLuint to stream
-                number = ss.str();
-                // Now set the sampler to the correct texture unit
-                glUniform1i(glGetUniformLocation(shader.getHandle(), (name + number).c_str()), i);
+                // Now set the sampler to the correct texture unit, the location comes from the program's cache
+                shader.setUniform(this->samplerNames[i].c_str(), (int)i);
                 // And finally bind the texture
                 glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
             }
         }
         // Draw mesh
         glBindVertexArray(this->VAO);
-        glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
+        if(instanceCount == 1 && baseInstance == 0)
+            glDrawElements(GL_TRIANGLES, this->indexCount, this->indexType, 0);
+        else if(baseInstance == 0)
+            glDrawElementsInstanced(GL_TRIANGLES, this->indexCount,
+                                    this->indexType, 0, instanceCount);
+        else
+            glDrawElementsInstancedBaseInstance(GL_TRIANGLES, this->indexCount,
+                                                this->indexType, 0, instanceCount,
+                                                baseInstance);
         glBindVertexArray(0);
 
+        // The textures stay bound; whatever draws next binds what it samples
+    }
 
-        if(!shadow)
+    // Attaches a buffer of InstanceData to the mesh's VAO as per-instance attributes
+    void setInstanceBuffer(GLuint instanceVBO)
+    {
+        glBindVertexArray(this->VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+
+        // A mat4 attribute takes four consecutive locations, one per column
+        for(GLuint i = 0; i < 4; i++)
         {
-            // Always good practice to set everything back to defaults once configured.
-            for (GLuint i = 0; i < this->textures.size(); i++)
-            {
-                glActiveTexture(GL_TEXTURE0 + i);
-                glBindTexture(GL_TEXTURE_2D, 0);
-            }
+            glEnableVertexAttribArray(3 + i);
+            glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                                  (GLvoid*)(offsetof(InstanceData, Model) + i * sizeof(glm::vec4)));
+            glVertexAttribDivisor(3 + i, 1);
         }
+        // Material index
+        glEnableVertexAttribArray(7);
+        glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, sizeof(InstanceData),
+                               (GLvoid*)offsetof(InstanceData, Material));
+        glVertexAttribDivisor(7, 1);
+
+        glBindVertexArray(0);
     }
 
+    // What DrawInstanced draws, for callers that issue the draw themselves.
+    // The mesh's textures are not part of it.
+    GLuint getVAO() const { return this->VAO; }
+    GLsizei getIndexCount() const { return this->indexCount; }
+    GLenum getIndexType() const { return this->indexType; }
+
 private:
     /*  Render data  */
     GLuint VAO, VBO, EBO;
+    vector<string> samplerNames;    // Sampler uniform of each texture, e.g. texture_diffuse1
+    GLsizei indexCount;
+    GLenum indexType;
 
     /*  Functions    */
+    // Names the samplers once, so drawing doesn't build strings
+    void setupSamplerNames()
+    {
+        GLuint diffuseNr = 1;
+        GLuint specularNr = 1;
+        this->samplerNames.clear();
+        for(GLuint i = 0; i < this->textures.size(); i++)
+        {
+            // Retrieve texture number (the N in diffuse_textureN)
+            stringstream ss;
+            string name = this->textures[i].type;
+            if(name == "texture_diffuse")
+                ss << diffuseNr++; // Transfer GLuint to stream
+            else if(name == "texture_specular")
+                ss << specularNr++; // Transfer GLuint to stream
+            this->samplerNames.push_back(name + ss.str());
+        }
+    }
+
     // Initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(const Vertex *vertices, GLsizei numVertices, const GLuint *indices,
+                   GLsizei numIndices)
     {
+        this->indexCount = numIndices;
+
         // Create buffers/arrays
         glGenVertexArrays(1, &this->VAO);
         glGenBuffers(1, &this->VBO);
         glGenBuffers(1, &this->EBO);
 
         glBindVertexArray(this->VAO);
+
+        // Meshes that half floats can't place closely enough keep the float layout
+        if(VertexPacking::isEnabled() &&
+           VertexPacking::canPackPositions(&vertices[0].Position.x, numVertices, sizeof(Vertex) / sizeof(float)))
+        {
+            // Half the size of Vertex, decoded by the vertex fetch so the shaders don't change
+            vector<PackedVertex> packed(numVertices);
+            for(GLsizei i = 0; i < numVertices; i++)
+                packed[i] = VertexPacking::pack(&vertices[i].Position.x, &vertices[i].Normal.x,
+                                                &vertices[i].TexCoords.x);
+
+            glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+            glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(PackedVertex), packed.data(), GL_STATIC_DRAW);
+            VertexPacking::setAttributes();
+
+            this->indexType = VertexPacking::uploadIndices(this->EBO, indices, numIndices, numVertices);
+
+            glBindVertexArray(0);
+            return;
+        }
+
+        this->indexType = GL_UNSIGNED_INT;
+
         // Load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex), vertices, GL_STATIC_DRAW);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(GLuint), indices, GL_STATIC_DRAW);
 
         // Set the vertex attribute pointers
         // Vertex Positions
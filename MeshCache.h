@@ -0,0 +1,184 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <fstream>
+using namespace std;
+#ifdef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+
+// Binary sidecar written next to a model (path + ".meshcache") so warm starts
+// skip Assimp. Layout, every section 16 byte aligned:
+//   MeshCacheHeader
+//   MeshCacheRecord[NumMeshes]
+//   MeshCacheTexture[NumTextures]
+//   string table (texture types and paths, not null terminated)
+//   per mesh: Vertex[NumVertices], GLuint[NumIndices]
+// The vertex and index arrays are in the exact layout of the GL buffers, so
+// a mapped file is uploaded without touching the data.
+
+const char MESH_CACHE_MAGIC[4] = {'G', 'L', 'M', 'C'};
+// Bump whenever the layout or the Assimp post-processing flags change
+const GLuint MESH_CACHE_VERSION = 1;
+
+// MeshCacheHeader::Flags
+const GLuint MESH_CACHE_OPTIMIZED = 1;  // Index and vertex order went through MeshOptimizer
+
+struct MeshCacheHeader {
+    char Magic[4];
+    GLuint Version;
+    GLuint VertexSize;      // sizeof(Vertex) of the writer
+    GLuint NumMeshes;
+    GLuint NumTextures;
+    GLuint Flags;           // Loader options baked into the data, must match
+    GLuint64 SourceSize;    // Size and modification time of the source asset and its
+    GLint64 SourceTime;     // material libraries, the sidecar is stale when either differs
+    GLuint64 StringsOffset;
+    GLuint64 StringsSize;
+};
+
+struct MeshCacheRecord {
+    GLuint64 VertexOffset;
+    GLuint64 IndexOffset;
+    GLuint NumVertices;
+    GLuint NumIndices;
+    GLuint FirstTexture;    // Range of this mesh's entries in the texture table
+    GLuint NumTextures;
+};
+
+struct MeshCacheTexture {
+    GLuint TypeOffset;      // Offsets into the string table
+    GLuint TypeLength;
+    GLuint PathOffset;
+    GLuint PathLength;
+};
+
+// Rounds a file offset up to the alignment used between sections
+inline GLuint64 MeshCacheAlign(GLuint64 offset)
+{
+    return (offset + 15) & ~(GLuint64)15;
+}
+
+// Size and modification time of a file, false if it can't be read
+inline bool MeshCacheFileStamp(const string &path, GLuint64 &size, GLint64 &time)
+{
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0)
+        return false;
+    size = (GLuint64)info.st_size;
+    time = (GLint64)info.st_mtime;
+    return true;
+}
+
+// Stamp of a model: its file's size and time, plus for an .obj the sizes and
+// the latest time of the .mtl files it names, so editing a material also
+// makes the sidecar stale. Only the mtllib lines ahead of the first vertex are
+// looked at, which is where exporters put them. False if the model can't be read.
+inline bool MeshCacheSourceStamp(const string &path, GLuint64 &size, GLint64 &time)
+{
+    if(!MeshCacheFileStamp(path, size, time))
+        return false;
+
+    if(path.size() < 4 || path.compare(path.size() - 4, 4, ".obj") != 0)
+        return true;
+
+    ifstream in(path.c_str());
+    string directory = path.substr(0, path.find_last_of("/\\") + 1);
+    string line;
+    while(getline(in, line))
+    {
+        if(line.compare(0, 2, "v ") == 0)
+            break;
+        if(line.compare(0, 7, "mtllib ") != 0)
+            continue;
+
+        size_t begin = line.find_first_not_of(" \t", 7);
+        size_t end = line.find_last_not_of(" \t\r");
+        if(begin == string::npos || end < begin)
+            continue;
+        string library = line.substr(begin, end - begin + 1);
+        GLuint64 librarySize;
+        GLint64 libraryTime;
+        // A missing library is as Assimp treats it, no materials
+        if(!MeshCacheFileStamp(directory + library, librarySize, libraryTime))
+            continue;
+        size += librarySize;
+        if(libraryTime > time)
+            time = libraryTime;
+    }
+    return true;
+}
+
+// Read-only view of a whole file. Memory-mapped where the platform allows it,
+// otherwise read into memory.
+class MappedFile
+{
+public:
+    MappedFile() : data(NULL), size(0) { }
+
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if(this->data != NULL)
+            munmap((void *)this->data, this->size);
+#endif
+    }
+
+    bool Open(const string &path)
+    {
+#ifdef _WIN32
+        ifstream in(path.c_str(), ios::in | ios::binary);
+        if(!in)
+            return false;
+        this->buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        this->size = this->buffer.size();
+        this->data = this->buffer.empty() ? NULL : (const unsigned char *)&this->buffer[0];
+        return this->data != NULL;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+
+        struct stat info;
+        if(fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        void *mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping stays valid after the descriptor is closed
+        close(fd);
+        if(mapped == MAP_FAILED)
+            return false;
+
+        this->data = (const unsigned char *)mapped;
+        this->size = (size_t)info.st_size;
+        return true;
+#endif
+    }
+
+    const unsigned char *Data() const { return this->data; }
+    size_t Size() const { return this->size; }
+
+private:
+    const unsigned char *data;
+    size_t size;
+#ifdef _WIN32
+    vector<char> buffer;
+#endif
+
+    // Non-copyable
+    MappedFile(const MappedFile &other) { }
+    MappedFile &operator=(const MappedFile &other) { return *this; }
+};
@@ -0,0 +1,341 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cmath>
+using namespace std;
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+
+// Reorders triangle lists for the GPU after loading:
+//  1. OptimizeVertexCache - Tom Forsyth's linear-speed vertex cache optimisation
+//  2. OptimizeOverdraw    - splits the result into clusters at cache restarts and draws the
+//                           outward facing clusters first, so early-z rejects more of the rest
+//  3. OptimizeVertexFetch - renumbers the vertices in first-use order so fetches stream through memory
+// AnalyzeVertexCache simulates a FIFO post-transform cache to measure the result.
+namespace MeshOptimizer
+{
+    // Size of the simulated cache used for scoring and for the statistics
+    const GLuint CACHE_SIZE = 32;
+    // Hardware-ish FIFO size used to find cluster boundaries
+    const GLuint CLUSTER_CACHE_SIZE = 16;
+
+    struct VertexCacheStats {
+        GLuint Misses;
+        GLuint Triangles;
+        GLuint Vertices;
+
+        // Average cache miss ratio: transformed vertices per triangle, 0.5 at best
+        GLfloat ACMR() const { return Triangles ? (GLfloat)Misses / Triangles : 0.0f; }
+        // Average transform to vertex ratio: 1.0 means every vertex is shaded exactly once
+        GLfloat ATVR() const { return Vertices ? (GLfloat)Misses / Vertices : 0.0f; }
+
+        VertexCacheStats &operator+=(const VertexCacheStats &other)
+        {
+            Misses += other.Misses;
+            Triangles += other.Triangles;
+            Vertices += other.Vertices;
+            return *this;
+        }
+    };
+
+    // Counts the vertex shader invocations of a triangle list through a FIFO cache
+    inline VertexCacheStats AnalyzeVertexCache(const vector<GLuint> &indices, GLuint vertexCount,
+                                               GLuint cacheSize = CACHE_SIZE)
+    {
+        VertexCacheStats stats = {0, (GLuint)(indices.size() / 3), vertexCount};
+
+        // Timestamp of each vertex's entry into the cache, the cache holds the last cacheSize entries
+        vector<GLuint> entered(vertexCount, 0);
+        GLuint time = cacheSize + 1;
+        for(GLuint i = 0; i < indices.size(); i++)
+        {
+            GLuint v = indices[i];
+            if(time - entered[v] > cacheSize)
+            {
+                entered[v] = time++;
+                stats.Misses++;
+            }
+        }
+        return stats;
+    }
+
+    inline GLfloat forsythVertexScore(GLint cachePosition, GLuint remainingTriangles)
+    {
+        const GLfloat CacheDecayPower = 1.5f;
+        const GLfloat LastTriScore = 0.75f;
+        const GLfloat ValenceBoostScale = 2.0f;
+        const GLfloat ValenceBoostPower = 0.5f;
+
+        // No triangle left to use it
+        if(remainingTriangles == 0)
+            return -1.0f;
+
+        GLfloat score = 0.0f;
+        if(cachePosition >= 0)
+        {
+            // The three vertices of the last triangle get a fixed score so the next triangle
+            // doesn't simply reuse the last edge over and over
+            if(cachePosition < 3)
+                score = LastTriScore;
+            else
+            {
+                GLfloat scaler = 1.0f / (CACHE_SIZE - 3);
+                score = pow(1.0f - (cachePosition - 3) * scaler, CacheDecayPower);
+            }
+        }
+
+        // Boost vertices with few triangles left so lone triangles don't get stranded
+        score += ValenceBoostScale * pow((GLfloat)remainingTriangles, -ValenceBoostPower);
+        return score;
+    }
+
+    // Reorders the triangles of a triangle list for the post-transform vertex cache
+    inline void OptimizeVertexCache(vector<GLuint> &indices, GLuint vertexCount)
+    {
+        GLuint triangleCount = indices.size() / 3;
+        if(triangleCount == 0)
+            return;
+
+        // Triangles using each vertex, as one flat array with per-vertex offsets
+        vector<GLuint> remaining(vertexCount, 0);
+        for(GLuint i = 0; i < indices.size(); i++)
+            remaining[indices[i]]++;
+
+        vector<GLuint> adjacencyOffset(vertexCount + 1, 0);
+        for(GLuint v = 0; v < vertexCount; v++)
+            adjacencyOffset[v + 1] = adjacencyOffset[v] + remaining[v];
+
+        vector<GLuint> adjacency(indices.size());
+        vector<GLuint> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+        for(GLuint t = 0; t < triangleCount; t++)
+            for(GLuint k = 0; k < 3; k++)
+                adjacency[fill[indices[t * 3 + k]]++] = t;
+
+        vector<GLint> cachePosition(vertexCount, -1);
+        vector<GLfloat> vertexScore(vertexCount);
+        for(GLuint v = 0; v < vertexCount; v++)
+            vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+
+        vector<GLfloat> triangleScore(triangleCount);
+        for(GLuint t = 0; t < triangleCount; t++)
+            triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] +
+                               vertexScore[indices[t * 3 + 2]];
+
+        vector<bool> emitted(triangleCount, false);
+        vector<GLuint> result;
+        result.reserve(indices.size());
+
+        vector<GLuint> cache, nextCache;
+        cache.reserve(CACHE_SIZE + 3);
+        nextCache.reserve(CACHE_SIZE + 3);
+
+        GLuint scanCursor = 0;
+        GLint best = 0;
+        for(GLuint i = 0; i < triangleCount; i++)
+        {
+            if(best < 0)
+            {
+                // Nothing in the cache has triangles left, take the best remaining one
+                GLfloat bestScore = -1.0f;
+                for(GLuint t = scanCursor; t < triangleCount; t++)
+                {
+                    if(!emitted[t] && triangleScore[t] > bestScore)
+                    {
+                        bestScore = triangleScore[t];
+                        best = t;
+                    }
+                }
+                while(scanCursor < triangleCount && emitted[scanCursor])
+                    scanCursor++;
+            }
+
+            emitted[best] = true;
+            const GLuint *tri = &indices[best * 3];
+            result.insert(result.end(), tri, tri + 3);
+
+            // Take the triangle out of its vertices' adjacency lists
+            for(GLuint k = 0; k < 3; k++)
+            {
+                GLuint v = tri[k];
+                GLuint *list = &adjacency[adjacencyOffset[v]];
+                for(GLuint j = 0; j < remaining[v]; j++)
+                {
+                    if(list[j] == (GLuint)best)
+                    {
+                        list[j] = list[remaining[v] - 1];
+                        break;
+                    }
+                }
+                remaining[v]--;
+            }
+
+            // LRU update: the new triangle goes to the front, the rest keep their order
+            nextCache.assign(tri, tri + 3);
+            for(GLuint j = 0; j < cache.size(); j++)
+            {
+                GLuint v = cache[j];
+                if(v != tri[0] && v != tri[1] && v != tri[2])
+                    nextCache.push_back(v);
+            }
+            // Vertices pushed out of the cache lose their cache score
+            for(GLuint j = CACHE_SIZE; j < nextCache.size(); j++)
+            {
+                cachePosition[nextCache[j]] = -1;
+                vertexScore[nextCache[j]] = forsythVertexScore(-1, remaining[nextCache[j]]);
+            }
+            if(nextCache.size() > CACHE_SIZE)
+                nextCache.resize(CACHE_SIZE);
+            cache.swap(nextCache);
+
+            for(GLuint j = 0; j < cache.size(); j++)
+            {
+                cachePosition[cache[j]] = j;
+                vertexScore[cache[j]] = forsythVertexScore(j, remaining[cache[j]]);
+            }
+
+            // Rescore the triangles touching the cache and pick the next one from them
+            best = -1;
+            GLfloat bestScore = -1.0f;
+            for(GLuint j = 0; j < cache.size(); j++)
+            {
+                GLuint v = cache[j];
+                const GLuint *list = &adjacency[adjacencyOffset[v]];
+                for(GLuint n = 0; n < remaining[v]; n++)
+                {
+                    GLuint t = list[n];
+                    GLfloat score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] +
+                                    vertexScore[indices[t * 3 + 2]];
+                    triangleScore[t] = score;
+                    if(score > bestScore)
+                    {
+                        bestScore = score;
+                        best = t;
+                    }
+                }
+            }
+        }
+
+        indices.swap(result);
+    }
+
+    // Sorts cache-friendly clusters of triangles so the ones facing away from the mesh centre
+    // are drawn first. Clusters start wherever the cache restarts, so their order barely
+    // affects the ACMR; the sort is dropped if it would raise it by more than threshold.
+    inline void OptimizeOverdraw(vector<GLuint> &indices, const vector<Vertex> &vertices,
+                                 GLfloat threshold = 1.05f)
+    {
+        GLuint triangleCount = indices.size() / 3;
+        if(triangleCount == 0)
+            return;
+
+        // Cluster boundaries: triangles where all three vertices miss the cache
+        vector<GLuint> clusterStart;
+        vector<GLuint> entered(vertices.size(), 0);
+        GLuint time = CLUSTER_CACHE_SIZE + 1;
+        for(GLuint t = 0; t < triangleCount; t++)
+        {
+            GLuint misses = 0;
+            for(GLuint k = 0; k < 3; k++)
+            {
+                GLuint v = indices[t * 3 + k];
+                if(time - entered[v] > CLUSTER_CACHE_SIZE)
+                {
+                    entered[v] = time++;
+                    misses++;
+                }
+            }
+            if(misses == 3 || t == 0)
+                clusterStart.push_back(t);
+        }
+        clusterStart.push_back(triangleCount);
+        GLuint clusterCount = clusterStart.size() - 1;
+        if(clusterCount < 2)
+            return;
+
+        glm::vec3 meshCentroid(0.0f);
+        for(GLuint i = 0; i < vertices.size(); i++)
+            meshCentroid += vertices[i].Position;
+        meshCentroid /= (GLfloat)vertices.size();
+
+        // Area weighted normal and centroid of each cluster
+        vector< pair<GLfloat, GLuint> > order(clusterCount);
+        for(GLuint c = 0; c < clusterCount; c++)
+        {
+            glm::vec3 normal(0.0f), centroid(0.0f);
+            GLfloat area = 0.0f;
+            for(GLuint t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+            {
+                glm::vec3 p0 = vertices[indices[t * 3]].Position;
+                glm::vec3 p1 = vertices[indices[t * 3 + 1]].Position;
+                glm::vec3 p2 = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+                GLfloat a = glm::length(n);
+                normal += n;
+                centroid += (p0 + p1 + p2) * (a / 3.0f);
+                area += a;
+            }
+            if(area > 0.0f)
+                centroid /= area;
+            GLfloat length = glm::length(normal);
+            if(length > 0.0f)
+                normal /= length;
+
+            // Larger means facing outwards, more likely to occlude the rest of the mesh
+            order[c] = make_pair(-glm::dot(centroid - meshCentroid, normal), c);
+        }
+        stable_sort(order.begin(), order.end());
+
+        vector<GLuint> result;
+        result.reserve(indices.size());
+        for(GLuint i = 0; i < clusterCount; i++)
+        {
+            GLuint c = order[i].second;
+            result.insert(result.end(), indices.begin() + clusterStart[c] * 3,
+                          indices.begin() + clusterStart[c + 1] * 3);
+        }
+
+        GLfloat before = AnalyzeVertexCache(indices, vertices.size()).ACMR();
+        GLfloat after = AnalyzeVertexCache(result, vertices.size()).ACMR();
+        if(after <= before * threshold)
+            indices.swap(result);
+    }
+
+    // Renumbers the vertices in the order the indices first use them. Unreferenced vertices are dropped.
+    inline void OptimizeVertexFetch(vector<Vertex> &vertices, vector<GLuint> &indices)
+    {
+        const GLuint Unused = ~0u;
+        vector<GLuint> remap(vertices.size(), Unused);
+        vector<Vertex> result;
+        result.reserve(vertices.size());
+
+        for(GLuint i = 0; i < indices.size(); i++)
+        {
+            GLuint v = indices[i];
+            if(remap[v] == Unused)
+            {
+                remap[v] = result.size();
+                result.push_back(vertices[v]);
+            }
+            indices[i] = remap[v];
+        }
+
+        vertices.swap(result);
+    }
+
+    // Runs all three passes. Returns the cache statistics from before and after.
+    inline void Optimize(vector<Vertex> &vertices, vector<GLuint> &indices,
+                         VertexCacheStats &before, VertexCacheStats &after)
+    {
+        before = AnalyzeVertexCache(indices, vertices.size());
+
+        OptimizeVertexCache(indices, vertices.size());
+        OptimizeOverdraw(indices, vertices);
+        OptimizeVertexFetch(vertices, indices);
+
+        after = AnalyzeVertexCache(indices, vertices.size());
+    }
+}
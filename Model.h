@@ -5,7 +5,12 @@
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
+#include <cstdio>
+#include <cstring>
 #include <vector>
+#include <utility>
+#include <algorithm>
 using namespace std;
 // GL Includes
 #include <GL/glew.h> // Contains all the necessery OpenGL includes
@@ -17,6 +22,9 @@ using namespace std;
 #include <assimp/postprocess.h>
 
 #include "Mesh.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "textureloader.h"
 
 GLint TextureFromFile(const char* path, string directory);
 
@@ -24,10 +32,29 @@ class Model
 {
 public:
     /*  Functions   */
-    // Constructor, expects a filepath to a 3D model.
-    Model(GLchar* path)
+    // Constructor, expects a filepath to a 3D model. Unless keepMeshData is set the
+    // CPU copies of the vertices and indices are freed once they are on the GPU.
+    // optimizeMeshes runs the MeshOptimizer passes on every mesh as it is imported.
+    Model(GLchar* path, bool keepMeshData = false, bool optimizeMeshes = true) :
+        instanceVBO(0), instanceCount(0), instanceCapacity(0), optimizeMeshes(optimizeMeshes)
     {
         this->loadModel(path);
+
+        if(!keepMeshData)
+        {
+            for(GLuint i = 0; i < this->meshes.size(); i++)
+                this->meshes[i].releaseMeshData();
+        }
+    }
+
+    // Hands the model's textures back to the shared texture cache
+    ~Model()
+    {
+        if(TextureLoader::getShared() == NULL)
+            return;
+        for(unordered_map<string, Texture>::iterator it = this->textures_loaded.begin();
+            it != this->textures_loaded.end(); ++it)
+            TextureLoader::getShared()->release(it->second.id);
     }
 
     // Draws the model, and thus all its meshes
@@ -37,16 +64,105 @@ public:
             this->meshes[i].Draw(shader, shadow);
     }
 
+    // Uploads the per-instance transforms and material indices used by DrawInstanced.
+    // With first > 0 the instances are written after the ones already there,
+    // for extra sets drawn with the ranged DrawInstanced; instances before
+    // first are kept when the buffer has to grow.
+    void setInstances(const vector<InstanceData> &instances, GLsizei first = 0)
+    {
+        if(instances.empty())
+            return;
+
+        GLsizei end = first + (GLsizei)instances.size();
+        if(this->instanceVBO == 0 || end > this->instanceCapacity)
+        {
+            // Grow geometrically so per-frame sets settle on one allocation
+            GLsizei capacity = max(end, this->instanceCapacity * 2);
+            GLuint buffer;
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, capacity * sizeof(InstanceData), NULL, GL_DYNAMIC_DRAW);
+            if(this->instanceVBO != 0)
+            {
+                if(first > 0)
+                {
+                    glBindBuffer(GL_COPY_READ_BUFFER, this->instanceVBO);
+                    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                                        min(first, this->instanceCapacity) * sizeof(InstanceData));
+                    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+                }
+                glDeleteBuffers(1, &this->instanceVBO);
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+            this->instanceVBO = buffer;
+            this->instanceCapacity = capacity;
+            for(GLuint i = 0; i < this->meshes.size(); i++)
+                this->meshes[i].setInstanceBuffer(this->instanceVBO);
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(InstanceData),
+                        instances.size() * sizeof(InstanceData), &instances[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        if(first == 0)
+            this->instanceCount = instances.size();
+    }
+
+    // Draws every instance set with setInstances, one draw call per mesh
+    void DrawInstanced(GLSLProgram &shader, bool shadow = false)
+    {
+        for(GLuint i = 0; i < this->meshes.size(); i++)
+            this->meshes[i].DrawInstanced(shader, this->instanceCount, shadow);
+    }
+
+    // Draws count instances starting at first, one draw call per mesh
+    void DrawInstanced(GLSLProgram &shader, GLsizei first, GLsizei count, bool shadow = false)
+    {
+        if(count <= 0)
+            return;
+        for(GLuint i = 0; i < this->meshes.size(); i++)
+            this->meshes[i].DrawInstanced(shader, count, shadow, first);
+    }
+
+    GLsizei getNumMeshes() const
+    {
+        return (GLsizei)this->meshes.size();
+    }
+
+    const Mesh &getMesh(GLsizei i) const
+    {
+        return this->meshes[i];
+    }
+
 private:
+    // Non-copyable, the textures are released once per model
+    Model(const Model &other) { }
+    Model &operator=(const Model &other) { return *this; }
+
     /*  Model Data  */
     vector<Mesh> meshes;
     string directory;
-    vector<Texture> textures_loaded;	// Stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+    GLuint instanceVBO;
+    GLsizei instanceCount;
+    GLsizei instanceCapacity;
+    bool optimizeMeshes;
+    MeshOptimizer::VertexCacheStats statsBefore, statsAfter;   // Totals over all meshes
+    unordered_map<string, Texture> textures_loaded;	// Stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
 
     /*  Functions   */
     // Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    // A binary sidecar (path + ".meshcache") is used instead when it is up to date, and written when it isn't.
     void loadModel(string path)
     {
+        // Retrieve the directory path of the filepath
+        this->directory = path.substr(0, path.find_last_of('/'));
+
+        string cachePath = path + ".meshcache";
+        if(this->loadCache(path, cachePath))
+            return;
+
         // Read file via ASSIMP
         Assimp::Importer importer;
         const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
@@ -56,11 +172,182 @@ private:
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
             return;
         }
-        // Retrieve the directory path of the filepath
-        this->directory = path.substr(0, path.find_last_of('/'));
-
         // Process ASSIMP's root node recursively
+        this->meshes.reserve(scene->mNumMeshes);
+        this->statsBefore = this->statsAfter = MeshOptimizer::VertexCacheStats();
         this->processNode(scene->mRootNode, scene);
+
+        if(this->optimizeMeshes)
+            printf("Optimized %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", path.c_str(),
+                   this->statsBefore.ACMR(), this->statsAfter.ACMR(),
+                   this->statsBefore.ATVR(), this->statsAfter.ATVR());
+
+        this->writeCache(path, cachePath);
+    }
+
+    // Maps the sidecar and uploads its arrays straight into the mesh buffers. Returns false, leaving the
+    // model untouched, if the sidecar is missing, was written for another source or build, or is truncated.
+    bool loadCache(const string &path, const string &cachePath)
+    {
+        GLuint64 sourceSize;
+        GLint64 sourceTime;
+        if(!MeshCacheSourceStamp(path, sourceSize, sourceTime))
+            return false;
+
+        MappedFile file;
+        if(!file.Open(cachePath) || file.Size() < sizeof(MeshCacheHeader))
+            return false;
+
+        const unsigned char *data = file.Data();
+        const MeshCacheHeader *header = (const MeshCacheHeader *)data;
+        if(memcmp(header->Magic, MESH_CACHE_MAGIC, 4) != 0 ||
+           header->Version != MESH_CACHE_VERSION ||
+           header->VertexSize != sizeof(Vertex) ||
+           header->Flags != this->cacheFlags() ||
+           header->SourceSize != sourceSize || header->SourceTime != sourceTime)
+            return false;
+
+        // Check every range against the file size before touching it
+        GLuint64 tablesEnd = MeshCacheAlign(sizeof(MeshCacheHeader)) +
+                             header->NumMeshes * sizeof(MeshCacheRecord) +
+                             header->NumTextures * sizeof(MeshCacheTexture);
+        if(tablesEnd > file.Size() || header->StringsOffset + header->StringsSize > file.Size())
+            return false;
+
+        const MeshCacheRecord *records = (const MeshCacheRecord *)(data + MeshCacheAlign(sizeof(MeshCacheHeader)));
+        const MeshCacheTexture *textureTable = (const MeshCacheTexture *)(records + header->NumMeshes);
+        const char *strings = (const char *)(data + header->StringsOffset);
+
+        for(GLuint i = 0; i < header->NumMeshes; i++)
+        {
+            const MeshCacheRecord &record = records[i];
+            if(record.VertexOffset + record.NumVertices * sizeof(Vertex) > file.Size() ||
+               record.IndexOffset + record.NumIndices * sizeof(GLuint) > file.Size() ||
+               record.FirstTexture + record.NumTextures > header->NumTextures)
+                return false;
+            for(GLuint j = 0; j < record.NumTextures; j++)
+            {
+                const MeshCacheTexture &entry = textureTable[record.FirstTexture + j];
+                if(entry.TypeOffset + entry.TypeLength > header->StringsSize ||
+                   entry.PathOffset + entry.PathLength > header->StringsSize)
+                    return false;
+            }
+        }
+
+        for(GLuint i = 0; i < header->NumMeshes; i++)
+        {
+            const MeshCacheRecord &record = records[i];
+
+            vector<Texture> textures;
+            for(GLuint j = 0; j < record.NumTextures; j++)
+            {
+                const MeshCacheTexture &entry = textureTable[record.FirstTexture + j];
+                string type(strings + entry.TypeOffset, entry.TypeLength);
+                aiString texturePath(string(strings + entry.PathOffset, entry.PathLength));
+                textures.push_back(this->loadTexture(texturePath, type));
+            }
+
+            this->meshes.push_back(Mesh((const Vertex *)(data + record.VertexOffset), record.NumVertices,
+                                        (const GLuint *)(data + record.IndexOffset), record.NumIndices,
+                                        textures));
+        }
+        return true;
+    }
+
+    GLuint cacheFlags()
+    {
+        return this->optimizeMeshes ? MESH_CACHE_OPTIMIZED : 0;
+    }
+
+    // Writes the meshes just loaded through Assimp to the sidecar. Goes through a temporary file so a
+    // crash half way never leaves a sidecar that looks valid.
+    void writeCache(const string &path, const string &cachePath)
+    {
+        MeshCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.Magic, MESH_CACHE_MAGIC, 4);
+        header.Version = MESH_CACHE_VERSION;
+        header.VertexSize = sizeof(Vertex);
+        header.Flags = this->cacheFlags();
+        header.NumMeshes = this->meshes.size();
+        if(!MeshCacheSourceStamp(path, header.SourceSize, header.SourceTime))
+            return;
+
+        // Texture table and string table
+        vector<MeshCacheRecord> records(this->meshes.size());
+        vector<MeshCacheTexture> textureTable;
+        string strings;
+        for(GLuint i = 0; i < this->meshes.size(); i++)
+        {
+            const Mesh &mesh = this->meshes[i];
+            records[i].NumVertices = mesh.vertices.size();
+            records[i].NumIndices = mesh.indices.size();
+            records[i].FirstTexture = textureTable.size();
+            records[i].NumTextures = mesh.textures.size();
+            for(GLuint j = 0; j < mesh.textures.size(); j++)
+            {
+                MeshCacheTexture entry;
+                entry.TypeOffset = strings.size();
+                entry.TypeLength = mesh.textures[j].type.size();
+                strings += mesh.textures[j].type;
+                entry.PathOffset = strings.size();
+                entry.PathLength = mesh.textures[j].path.length;
+                strings.append(mesh.textures[j].path.C_Str(), mesh.textures[j].path.length);
+                textureTable.push_back(entry);
+            }
+        }
+        header.NumTextures = textureTable.size();
+
+        // Section offsets
+        GLuint64 offset = MeshCacheAlign(sizeof(MeshCacheHeader)) +
+                          records.size() * sizeof(MeshCacheRecord) +
+                          textureTable.size() * sizeof(MeshCacheTexture);
+        header.StringsOffset = offset;
+        header.StringsSize = strings.size();
+        offset = MeshCacheAlign(offset + strings.size());
+        for(GLuint i = 0; i < records.size(); i++)
+        {
+            records[i].VertexOffset = offset;
+            offset = MeshCacheAlign(offset + records[i].NumVertices * sizeof(Vertex));
+            records[i].IndexOffset = offset;
+            offset = MeshCacheAlign(offset + records[i].NumIndices * sizeof(GLuint));
+        }
+
+        string tempPath = cachePath + ".tmp";
+        ofstream out(tempPath.c_str(), ios::out | ios::binary | ios::trunc);
+        if(!out)
+            return;
+
+        const char zeros[16] = {0};
+        out.write((const char *)&header, sizeof(header));
+        out.write(zeros, MeshCacheAlign(sizeof(header)) - sizeof(header));
+        if(!records.empty())
+            out.write((const char *)&records[0], records.size() * sizeof(MeshCacheRecord));
+        if(!textureTable.empty())
+            out.write((const char *)&textureTable[0], textureTable.size() * sizeof(MeshCacheTexture));
+        out.write(strings.data(), strings.size());
+        for(GLuint i = 0; i < records.size(); i++)
+        {
+            const Mesh &mesh = this->meshes[i];
+            out.write(zeros, records[i].VertexOffset - (GLuint64)out.tellp());
+            if(!mesh.vertices.empty())
+                out.write((const char *)&mesh.vertices[0], mesh.vertices.size() * sizeof(Vertex));
+            out.write(zeros, records[i].IndexOffset - (GLuint64)out.tellp());
+            if(!mesh.indices.empty())
+                out.write((const char *)&mesh.indices[0], mesh.indices.size() * sizeof(GLuint));
+        }
+        out.close();
+
+        if(!out)
+        {
+            remove(tempPath.c_str());
+            return;
+        }
+
+        // rename() won't replace an existing file everywhere
+        remove(cachePath.c_str());
+        if(rename(tempPath.c_str(), cachePath.c_str()) != 0)
+            remove(tempPath.c_str());
     }
 
     // Processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -88,6 +375,8 @@ private:
         vector<Vertex> vertices;
         vector<GLuint> indices;
         vector<Texture> textures;
+        vertices.reserve(mesh->mNumVertices);
+        indices.reserve(mesh->mNumFaces * 3); // Exact after aiProcess_Triangulate
 
         // Walk through each of the mesh's vertices
         for(GLuint i = 0; i < mesh->mNumVertices; i++)
@@ -126,7 +415,7 @@ private:
         // Now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
         for(GLuint i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace &face = mesh->mFaces[i]; // aiFace copies deep-copy their indices
             // Retrieve all indices of the face and store them in the indices vector
             for(GLuint j = 0; j < face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);
@@ -151,7 +440,15 @@ private:
         }
 
         // Return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        if(this->optimizeMeshes)
+        {
+            MeshOptimizer::VertexCacheStats before, after;
+            MeshOptimizer::Optimize(vertices, indices, before, after);
+            this->statsBefore += before;
+            this->statsAfter += after;
+        }
+
+        return Mesh(std::move(vertices), std::move(indices), std::move(textures));
     }
 
     // Checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -163,36 +460,40 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // Check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            GLboolean skip = false;
-            for(GLuint j = 0; j < textures_loaded.size(); j++)
-            {
-                if(textures_loaded[j].path == str)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // A texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // If texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str;
-                textures.push_back(texture);
-                this->textures_loaded.push_back(texture);  // Store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            textures.push_back(this->loadTexture(str, typeName));
         }
         return textures;
     }
+
+    // Loads a texture of the model's directory unless it was loaded before.
+    Texture loadTexture(const aiString &path, const string &typeName)
+    {
+        // Check if texture was loaded before and if so, reuse it instead of loading a new texture.
+        // Textures shared with other models are de-duplicated by the TextureLoader cache.
+        unordered_map<string, Texture>::iterator loaded = this->textures_loaded.find(path.C_Str());
+        if(loaded != this->textures_loaded.end())
+            return loaded->second; // A texture with the same filepath has already been loaded. (optimization)
+
+        // If texture hasn't been loaded already, load it
+        Texture texture;
+        texture.id = TextureFromFile(path.C_Str(), this->directory);
+        texture.type = typeName;
+        texture.path = path;
+        this->textures_loaded[path.C_Str()] = texture;  // Store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+        return texture;
+    }
 };
 
 GLint TextureFromFile(const char* path, string directory)
 {
-     //Generate texture ID and load texture data
     string filename = string(path);
     filename = directory + '/' + filename;
+
+    // Decode in the background when the application runs a texture loader
+    if(TextureLoader::getShared() != NULL)
+        return TextureLoader::getShared()->load(filename);
+
+     //Generate texture ID and load texture data
     GLuint textureID;
     glGenTextures(1, &textureID);
     int width,height;
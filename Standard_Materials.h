@@ -17,8 +17,25 @@ struct stdMaterial
     GLfloat shininess;
 };
 
+// std430 layout of a stdMaterial as read from the shaders' material buffer.
+// The shininess is stored in specular.w.
+struct stdMaterialBlock
+{
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+};
+
 map<string, stdMaterial> stdMatMap;
 
+stdMaterialBlock toMaterialBlock(const stdMaterial &material)
+{
+    stdMaterialBlock block = {glm::vec4(material.ambient, 1.0f),
+                              glm::vec4(material.diffuse, 1.0f),
+                              glm::vec4(material.specular, material.shininess)};
+    return block;
+}
+
 void loadStdMats()
 {
 
@@ -6,7 +6,16 @@
 #include <sstream>
 #include <iostream>
 #include <vector>
-#include <map>
+#include <deque>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/stat.h>
 using namespace std;
 
 // GL Includes
@@ -21,15 +30,108 @@ using namespace std;
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
+#include "DistanceField.h"
+
+// Character::State
+enum GlyphState { GLYPH_MISSING = 0, GLYPH_PENDING, GLYPH_READY };
+
+// Glyph metrics and the glyph's rectangle in the font atlas
 struct Character {
-    GLuint TextureID;   // ID handle of the glyph texture
     glm::ivec2 Size;    // Size of glyph
     glm::ivec2 Bearing;  // Offset from baseline to left/top of glyph
     FT_Pos Advance;    // Horizontal offset to advance to next glyph
+    glm::vec2 UVMin;    // Top left of the glyph in the atlas, in texels
+    glm::vec2 UVMax;    // Bottom right of the glyph in the atlas, in texels
+    GLint State;        // Not requested yet, being rasterized, or in the atlas
 };
 
-std::map<GLchar, Character> Characters;
+// Glyphs are looked up through pages of consecutive codepoints, allocated
+// the first time a codepoint of the page is drawn
+const GLuint TEXT_MAX_CODEPOINT = 0x10FFFF;
+const GLuint TEXT_PAGE_SIZE = 256;
+const GLuint TEXT_NUM_PAGES = (TEXT_MAX_CODEPOINT + 1) / TEXT_PAGE_SIZE;
+
+// The atlas has a fixed width and doubles its height when a glyph doesn't fit
+const int TEXT_ATLAS_WIDTH = 512;
+const int TEXT_ATLAS_INITIAL_HEIGHT = 64;
+
+// TEXT_BITMAP stores coverage rasterized at pixelSize and is sharp at scale
+// 1 only. TEXT_SDF stores a signed distance field with pixelSize as its
+// reference size; drawn with shaders/text_sdf.frag it stays sharp at any
+// scale, so one atlas serves every size.
+enum TextMode { TEXT_BITMAP, TEXT_SDF };
+
+// Distance field glyphs are rasterized at this multiple of pixelSize
+const int TEXT_SDF_UPSAMPLE = 4;
+// Distance in reference pixels covered by the field on either side of the edge
+const int TEXT_SDF_SPREAD = 4;
+
+// Distance field atlases are cached next to the font (font + ".<size>.sdfcache")
+// with every glyph rasterized so far, and are stale when the font's size or
+// time differs. Layout:
+//   TextCacheHeader, GLuint[NumGlyphs] codepoints, Character[NumGlyphs],
+//   TextKerningPair[NumKerningPairs], GLubyte[AtlasWidth * AtlasHeight]
+const char TEXT_CACHE_MAGIC[4] = {'G', 'L', 'S', 'D'};
+const GLuint TEXT_CACHE_VERSION = 3;
+
+struct TextCacheHeader {
+    char Magic[4];
+    GLuint Version;
+    GLuint CharacterSize;   // sizeof(Character) of the writer
+    GLuint NumGlyphs;
+    GLuint PixelSize;
+    GLuint Upsample;
+    GLuint Spread;
+    GLuint AtlasWidth;
+    GLuint AtlasHeight;
+    GLuint PenX;            // Where the atlas packer carries on
+    GLuint PenY;
+    GLuint RowHeight;
+    GLuint NumKerningPairs;
+    GLuint64 SourceSize;
+    GLint64 SourceTime;
+};
+
+struct TextKerningPair {
+    GLuint Pair;            // Left codepoint << 16 | right codepoint
+    GLint Amount;           // 1/64 pixels at pixelSize
+};
+
+// Decodes the UTF-8 sequence at pos and moves pos past it. Malformed input
+// yields U+FFFD and skips a single byte.
+inline GLuint DecodeUTF8(const string &text, size_t &pos)
+{
+    GLubyte lead = static_cast<GLubyte>(text[pos++]);
+    if (lead < 0x80)
+        return lead;
+
+    int extra;
+    GLuint code;
+    if ((lead & 0xE0) == 0xC0)      { extra = 1; code = lead & 0x1F; }
+    else if ((lead & 0xF0) == 0xE0) { extra = 2; code = lead & 0x0F; }
+    else if ((lead & 0xF8) == 0xF0) { extra = 3; code = lead & 0x07; }
+    else
+        return 0xFFFD;
+
+    if (pos + extra > text.size())
+        return 0xFFFD;
+    for (int i = 0; i < extra; i++)
+    {
+        GLubyte next = static_cast<GLubyte>(text[pos + i]);
+        if ((next & 0xC0) != 0x80)
+            return 0xFFFD;
+        code = (code << 6) | (next & 0x3F);
+    }
+    pos += extra;
+    return code;
+}
 
+class TextLayout;
+
+// Glyphs are rasterized on demand. The first time a codepoint is drawn it is
+// queued for a FreeType thread and left out of the string; update() packs
+// finished glyphs into the atlas, and layouts that were missing glyphs are
+// shaped again once they arrive.
 class Text {
 public:
 
@@ -38,65 +140,317 @@ public:
     int screenWidth;
     int screenHeight;
 
-    Text(GLSLProgram &shader, const char *fontPath, const int pixelSize, GLuint &screenWidth, GLuint &screenHeight)
+    TextMode mode;
+
+    Text(GLSLProgram &shader, const char *fontPath, const int pixelSize, GLuint &screenWidth, GLuint &screenHeight,
+         TextMode mode = TEXT_BITMAP)
     {
         this->fontPath = fontPath;
         this->pixelSize = pixelSize;
+        this->mode = mode;
         this->screenWidth = screenWidth;
         this->screenHeight = screenHeight;
         this->setupText(shader);
     }
 
+    ~Text()
+    {
+        if (this->worker.joinable())
+        {
+            {
+                lock_guard<mutex> lock(this->glyphMutex);
+                this->stopping = true;
+            }
+            this->glyphRequested.notify_all();
+            this->worker.join();
+        }
+
+        if (this->mode == TEXT_SDF && this->cacheDirty)
+            this->writeCache(this->cachePath());
+
+        if (this->fontLoaded)
+            FT_Done_Face(this->face);
+        if (this->libraryLoaded)
+            FT_Done_FreeType(this->ft);
+        for (size_t i = 0; i < this->pages.size(); i++)
+            delete[] this->pages[i];
+    }
+
+    // Lays the string out and draws it with a single call, all glyphs sample
+    // the same atlas texture. Strings that stay the same over several frames
+    // are cheaper drawn through a TextLayout.
     void render(GLSLProgram &shader, const string &text, GLfloat x, GLfloat y, GLfloat scale, glm::vec3 color)
     {
-        // Activate corresponding render state
-        shader.use();
-        shader.setUniform("textColor", color.x, color.y, color.z);
-        glActiveTexture(GL_TEXTURE0);
-        glBindVertexArray(this->VAO);
-
-        // Iterate through all characters
-        std::string::const_iterator c;
-        for (c = text.begin(); c != text.end(); c++)
-        {
-            Character ch;
-            ch = Characters[*c];
-
-            GLfloat xpos = x + ch.Bearing.x * scale;
-            GLfloat ypos = y - (ch.Size.y - ch.Bearing.y) * scale;
-
-            GLfloat w = ch.Size.x * scale;
-            GLfloat h = ch.Size.y * scale;
-            // Update VBO for each character
-            GLfloat vertices[6][4] = {
-                { xpos,     ypos + h,   0.0, 0.0 },
-                { xpos,     ypos,       0.0, 1.0 },
-                { xpos + w, ypos,       1.0, 1.0 },
-
-                { xpos,     ypos + h,   0.0, 0.0 },
-                { xpos + w, ypos,       1.0, 1.0 },
-                { xpos + w, ypos + h,   1.0, 0.0 }
-            };
-            // Render glyph texture over quad
-            glBindTexture(GL_TEXTURE_2D, ch.TextureID);
-            // Update content of VBO memory
-            glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices); // Be sure to use glBufferSubData and not glBufferData
-
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-            // Render quad
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-            // Now advance cursors for next glyph (note that advance is number of 1/64 pixels)
-            x += (ch.Advance >> 6) * scale; // Bitshift by 6 to get value in pixels (2^6 = 64 (divide amount of 1/64th pixels by 64 to get amount of pixels))
+        this->shape(text, scale, this->vertices);
+        if (this->vertices.empty())
+            return;
+
+        this->uploadVertices(this->VBO, this->vboCapacity, this->vertices);
+        this->draw(shader, this->VAO, static_cast<GLsizei>(this->vertices.size() / 4), x, y, color);
+    }
+
+    // Queues the glyphs of a string ahead of the first time it is drawn
+    void preload(const string &text)
+    {
+        size_t pos = 0;
+        while (pos < text.size())
+            this->findGlyph(DecodeUTF8(text, pos));
+    }
+
+    // Packs the glyphs the FreeType thread has finished into the atlas. The
+    // draw calls do this themselves; call it directly to pick glyphs up
+    // without drawing.
+    void update()
+    {
+        if (!this->glyphsFinished.load())
+            return;
+
+        vector<GlyphImage> glyphs;
+        {
+            lock_guard<mutex> lock(this->glyphMutex);
+            glyphs.swap(this->finished);
+            this->glyphsFinished = false;
+            this->pendingGlyphs -= static_cast<int>(glyphs.size());
+        }
+        if (glyphs.empty())
+            return;
+
+        int oldHeight = this->atlasHeight;
+        vector<glm::ivec2> offsets(glyphs.size());
+        for (size_t i = 0; i < glyphs.size(); i++)
+            offsets[i] = this->addGlyph(glyphs[i]);
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, this->atlas);
+        if (this->atlasHeight != oldHeight)
+        {
+            // Grown: texture coordinates are in texels, so nothing shaped
+            // before needs to change
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, TEXT_ATLAS_WIDTH, this->atlasHeight, 0,
+                         GL_RED, GL_UNSIGNED_BYTE, &this->atlasPixels[0]);
+        }
+        else
+        {
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, TEXT_ATLAS_WIDTH);
+            for (size_t i = 0; i < glyphs.size(); i++)
+            {
+                const GlyphImage &glyph = glyphs[i];
+                if (glyph.size.x == 0 || glyph.size.y == 0)
+                    continue;
+                glTexSubImage2D(GL_TEXTURE_2D, 0, offsets[i].x, offsets[i].y, glyph.size.x, glyph.size.y,
+                                GL_RED, GL_UNSIGNED_BYTE, &this->atlasPixels[offsets[i].y * TEXT_ATLAS_WIDTH + offsets[i].x]);
+            }
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
         }
-        glBindVertexArray(0);
         glBindTexture(GL_TEXTURE_2D, 0);
+
+        ++this->generation;
+        this->cacheDirty = true;
+    }
+
+    // Blocks until every glyph requested so far is in the atlas
+    void finish()
+    {
+        {
+            unique_lock<mutex> lock(this->glyphMutex);
+            this->glyphFinished.wait(lock, [this]() {
+                return this->pendingGlyphs == static_cast<int>(this->finished.size());
+            });
+        }
+        this->update();
     }
 
 private:
 
+    // A rasterized glyph on its way from the FreeType thread to the atlas
+    struct GlyphImage {
+        GLuint code;
+        glm::ivec2 size;
+        glm::ivec2 bearing;
+        FT_Pos advance;
+        vector<GLubyte> pixels;     // size.x * size.y
+        vector<GLubyte> source;     // Distance fields: hi-res coverage bitmap,
+        int sourceWidth, sourceRows; // placed at (offsetX, offsetY) in the field
+        int offsetX, offsetY;
+    };
+
     /*  Render data  */
     GLuint VAO, VBO;
+    GLsizeiptr vboCapacity;
+    GLuint atlas;
+    vector<GLfloat> vertices;   // Reused between calls to render()
+    GLSLUniform textColorUniform;
+    GLSLUniform offsetUniform;
+
+    // Glyph table, TEXT_NUM_PAGES pages of TEXT_PAGE_SIZE codepoints
+    vector<Character *> pages;
+    GLuint generation;          // Bumped whenever glyphs are added to the atlas
+    bool cacheDirty;
+
+    // CPU copy of the atlas and where the shelf packer carries on
+    vector<GLubyte> atlasPixels;
+    int atlasHeight;
+    int penX, penY, rowHeight;
+
+    // Kerning of each printable ASCII pair the font adjusts, in 1/64 pixels
+    unordered_map<GLuint, FT_Pos> kerning;
+
+    // FreeType; the face belongs to the worker thread once it has started
+    FT_Library ft;
+    FT_Face face;
+    bool libraryLoaded, fontLoaded;
+
+    std::thread worker;
+    mutex glyphMutex;
+    condition_variable glyphRequested;
+    condition_variable glyphFinished;
+    deque<GLuint> requests;         // Waiting for the worker
+    vector<GlyphImage> finished;    // Waiting for update()
+    int pendingGlyphs;              // Requested and not packed yet
+    bool stopping;
+    std::atomic<bool> glyphsFinished;
+
+    friend class TextLayout;
+
+    // Non-copyable
+    Text(const Text &other) { }
+    Text &operator=(const Text &other) { return *this; }
+
+    // The glyph of a codepoint if it is in the atlas. Otherwise it is
+    // requested from the FreeType thread and NULL returned.
+    const Character *findGlyph(GLuint code)
+    {
+        if (code > TEXT_MAX_CODEPOINT)
+            code = 0xFFFD;
+        Character *&page = this->pages[code / TEXT_PAGE_SIZE];
+        if (page == NULL)
+            page = new Character[TEXT_PAGE_SIZE]();
+
+        Character &ch = page[code % TEXT_PAGE_SIZE];
+        if (ch.State == GLYPH_READY)
+            return &ch;
+        if (ch.State == GLYPH_PENDING)
+            return NULL;
+
+        if (!this->fontLoaded)
+        {
+            // Nothing to rasterize with, draw it as empty from now on
+            ch.State = GLYPH_READY;
+            return &ch;
+        }
+        ch.State = GLYPH_PENDING;
+        {
+            lock_guard<mutex> lock(this->glyphMutex);
+            this->requests.push_back(code);
+            ++this->pendingGlyphs;
+        }
+        this->glyphRequested.notify_one();
+        return NULL;
+    }
+
+    // Lays out a string with its origin at (0, 0): decodes UTF-8, applies
+    // kerning and builds two triangles per visible glyph. Returns the
+    // advance width. Glyphs not rasterized yet are left out, complete
+    // tells whether there were any.
+    GLfloat shape(const string &text, GLfloat scale, vector<GLfloat> &out, bool *complete = NULL)
+    {
+        this->update();
+
+        out.clear();
+        out.reserve(text.size() * 6 * 4);
+        if (complete != NULL)
+            *complete = true;
+
+        GLfloat x = 0.0f;
+        GLuint previous = 0;
+        size_t pos = 0;
+        while (pos < text.size())
+        {
+            GLuint code = DecodeUTF8(text, pos);
+            const Character *ch = this->findGlyph(code);
+            if (ch == NULL)
+            {
+                if (complete != NULL)
+                    *complete = false;
+                previous = 0;
+                continue;
+            }
+
+            if (previous != 0 && previous < 128 && code < 128 && !this->kerning.empty())
+            {
+                unordered_map<GLuint, FT_Pos>::const_iterator kern = this->kerning.find((previous << 16) | code);
+                if (kern != this->kerning.end())
+                    x += (kern->second / 64.0f) * scale;
+            }
+            previous = code;
+
+            // Whitespace has no quad, only an advance
+            if (ch->Size.x > 0 && ch->Size.y > 0)
+            {
+                GLfloat xpos = x + ch->Bearing.x * scale;
+                GLfloat ypos = -(ch->Size.y - ch->Bearing.y) * scale;
+
+                GLfloat w = ch->Size.x * scale;
+                GLfloat h = ch->Size.y * scale;
+                GLfloat quad[6][4] = {
+                    { xpos,     ypos + h,   ch->UVMin.x, ch->UVMin.y },
+                    { xpos,     ypos,       ch->UVMin.x, ch->UVMax.y },
+                    { xpos + w, ypos,       ch->UVMax.x, ch->UVMax.y },
+
+                    { xpos,     ypos + h,   ch->UVMin.x, ch->UVMin.y },
+                    { xpos + w, ypos,       ch->UVMax.x, ch->UVMax.y },
+                    { xpos + w, ypos + h,   ch->UVMax.x, ch->UVMin.y }
+                };
+                out.insert(out.end(), &quad[0][0], &quad[0][0] + 6 * 4);
+            }
+            // Now advance cursors for next glyph (note that advance is number of 1/64 pixels)
+            x += (ch->Advance >> 6) * scale; // Bitshift by 6 to get value in pixels (2^6 = 64 (divide amount of 1/64th pixels by 64 to get amount of pixels))
+        }
+        return x;
+    }
+
+    // Creates a VAO/VBO pair in the glyph quad layout
+    void createVertexArray(GLuint &vao, GLuint &vbo, GLsizeiptr capacity)
+    {
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+
+    void uploadVertices(GLuint vbo, GLsizeiptr &capacity, const vector<GLfloat> &vertices)
+    {
+        GLsizeiptr size = static_cast<GLsizeiptr>(vertices.size() * sizeof(GLfloat));
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        // Grow in powers of two so a string that changes every frame settles
+        // on one size
+        while (capacity < size)
+            capacity *= 2;
+        // Orphan the old storage instead of waiting for the GPU to finish with it
+        glBufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, &vertices[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // One draw of shaped quads, moved to (x, y) in the vertex shader
+    void draw(GLSLProgram &shader, GLuint vao, GLsizei vertexCount, GLfloat x, GLfloat y, glm::vec3 color)
+    {
+        // Activate corresponding render state
+        shader.use();
+        shader.setUniform(this->textColorUniform, color.x, color.y, color.z);
+        shader.setUniform(this->offsetUniform, glm::vec2(x, y));
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, this->atlas);
+        glBindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
 
     /*  Functions    */
     // Initializes all the buffer objects/arrays
@@ -106,80 +460,485 @@ private:
         glm::mat4 projection = glm::ortho(0.0f, static_cast<GLfloat>(this->screenWidth), 0.0f, static_cast<GLfloat>(this->screenHeight));
         textShader.use();
         textShader.setUniform("projection", projection);
+        textShader.setUniform("text", 0);
+        this->textColorUniform = textShader.getUniform("textColor");
+        this->offsetUniform = textShader.getUniform("offset");
+
+        this->pages.assign(TEXT_NUM_PAGES, NULL);
+        this->generation = 0;
+        this->cacheDirty = false;
+        this->pendingGlyphs = 0;
+        this->stopping = false;
+        this->glyphsFinished = false;
 
         // FreeType
-        FT_Library ft;
         // All functions return a value different than 0 whenever an error occurred
-        if (FT_Init_FreeType(&ft))
+        this->libraryLoaded = FT_Init_FreeType(&this->ft) == 0;
+        if (!this->libraryLoaded)
             std::cout << "ERROR::FREETYPE: Could not init FreeType Library" << std::endl;
 
         // Load font as face
-        FT_Face face;
-        if (FT_New_Face(ft, this->fontPath, 0, &face))
+        this->fontLoaded = this->libraryLoaded && FT_New_Face(this->ft, this->fontPath, 0, &this->face) == 0;
+        if (!this->fontLoaded)
             std::cout << "ERROR::FREETYPE: Failed to load font" << std::endl;
+        else
+            // Set size to load glyphs as, distance fields start from a finer raster
+            FT_Set_Pixel_Sizes(this->face, 0, this->pixelSize * (this->mode == TEXT_SDF ? TEXT_SDF_UPSAMPLE : 1));
 
-        // Set size to load glyphs as
-        FT_Set_Pixel_Sizes(face, 0, this->pixelSize);
+        if (this->mode != TEXT_SDF || !this->loadCache(this->cachePath()))
+        {
+            this->atlasHeight = TEXT_ATLAS_INITIAL_HEIGHT;
+            this->atlasPixels.assign(TEXT_ATLAS_WIDTH * this->atlasHeight, 0);
+            this->penX = 1;
+            this->penY = 1;
+            this->rowHeight = 0;
+            this->loadKerning();
+        }
 
         // Disable byte-alignment restriction
         glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-        // Load first 128 characters of ASCII set
-        for (GLubyte c = 0; c < 128; c++)
+        glGenTextures(1, &this->atlas);
+        glBindTexture(GL_TEXTURE_2D, this->atlas);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, TEXT_ATLAS_WIDTH, this->atlasHeight, 0,
+                     GL_RED, GL_UNSIGNED_BYTE, &this->atlasPixels[0]);
+        // Set texture options
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // Configure VAO/VBO for texture quads, sized for a short string to start with
+        this->vboCapacity = sizeof(GLfloat) * 6 * 4 * 64;
+        this->createVertexArray(this->VAO, this->VBO, this->vboCapacity);
+
+        if (this->fontLoaded)
+            this->worker = std::thread(&Text::workerLoop, this);
+    }
+
+    // Kerning between printable ASCII characters, looked up while shaping
+    void loadKerning()
+    {
+        this->kerning.clear();
+        if (!this->fontLoaded || !FT_HAS_KERNING(this->face))
+            return;
+
+        const int upsample = this->mode == TEXT_SDF ? TEXT_SDF_UPSAMPLE : 1;
+        for (GLuint left = 32; left < 128; left++)
         {
-            // Load character glyph
-            if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+            FT_UInt leftIndex = FT_Get_Char_Index(this->face, left);
+            for (GLuint right = 32; right < 128; right++)
             {
-                std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl;
+                FT_Vector delta;
+                if (FT_Get_Kerning(this->face, leftIndex, FT_Get_Char_Index(this->face, right),
+                                   FT_KERNING_DEFAULT, &delta) == 0 && delta.x != 0)
+                    this->kerning[(left << 16) | right] = delta.x / upsample;
+            }
+        }
+    }
+
+    // FreeType thread: rasterizes whatever has been requested in one batch
+    // and hands it to update()
+    void workerLoop()
+    {
+        for (;;)
+        {
+            vector<GlyphImage> glyphs;
+            {
+                unique_lock<mutex> lock(this->glyphMutex);
+                this->glyphRequested.wait(lock, [this]() {
+                    return this->stopping || !this->requests.empty();
+                });
+                if (this->stopping)
+                    return;
+                glyphs.resize(this->requests.size());
+                for (size_t i = 0; i < glyphs.size(); i++)
+                    glyphs[i].code = this->requests[i];
+                this->requests.clear();
+            }
+
+            for (size_t i = 0; i < glyphs.size(); i++)
+                this->rasterizeGlyph(glyphs[i]);
+            if (this->mode == TEXT_SDF)
+                this->generateFields(glyphs);
+
+            {
+                lock_guard<mutex> lock(this->glyphMutex);
+                for (size_t i = 0; i < glyphs.size(); i++)
+                    this->finished.push_back(std::move(glyphs[i]));
+                this->glyphsFinished = true;
+            }
+            this->glyphFinished.notify_all();
+        }
+    }
+
+    // Renders one glyph with FreeType, on the worker thread
+    void rasterizeGlyph(GlyphImage &glyph)
+    {
+        const int upsample = this->mode == TEXT_SDF ? TEXT_SDF_UPSAMPLE : 1;
+        const int spread = TEXT_SDF_SPREAD;
+        glyph.size = glm::ivec2(0, 0);
+        glyph.bearing = glm::ivec2(0, 0);
+        glyph.advance = 0;
+
+        // Load character glyph
+        if (FT_Load_Char(this->face, glyph.code, FT_LOAD_RENDER))
+        {
+            std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl;
+            return;
+        }
+        const FT_Bitmap &bitmap = this->face->glyph->bitmap;
+        int width = static_cast<int>(bitmap.width);
+        int rows = static_cast<int>(bitmap.rows);
+        int left = this->face->glyph->bitmap_left;
+        int top = this->face->glyph->bitmap_top;
+
+        glyph.advance = this->face->glyph->advance.x / upsample;
+        if (width == 0 || rows == 0)
+            return;
+
+        vector<GLubyte> &image = this->mode == TEXT_SDF ? glyph.source : glyph.pixels;
+        image.resize(width * rows);
+        for (int row = 0; row < rows; row++)
+            memcpy(&image[row * width], bitmap.buffer + row * bitmap.pitch, width);
+
+        if (this->mode != TEXT_SDF)
+        {
+            glyph.size = glm::ivec2(width, rows);
+            glyph.bearing = glm::ivec2(left, top);
+            return;
+        }
+
+        // Snap the field's origin to whole reference pixels and leave
+        // spread pixels of margin around the glyph
+        int originX = (left >= 0 ? left / upsample : -((upsample - 1 - left) / upsample)) - spread;
+        int originY = (top >= 0 ? (top + upsample - 1) / upsample : -(-top / upsample)) + spread;
+        glyph.sourceWidth = width;
+        glyph.sourceRows = rows;
+        glyph.offsetX = left - originX * upsample;
+        glyph.offsetY = originY * upsample - top;
+        glyph.bearing = glm::ivec2(originX, originY);
+        glyph.size = glm::ivec2(
+            (glyph.offsetX + width + spread * upsample + upsample - 1) / upsample,
+            (glyph.offsetY + rows + spread * upsample + upsample - 1) / upsample);
+    }
+
+    // Distance transforms of a batch, spread over the cores since they are
+    // independent of each other
+    void generateFields(vector<GlyphImage> &glyphs)
+    {
+        std::atomic<size_t> next(0);
+        auto generate = [&]() {
+            for (size_t i = next++; i < glyphs.size(); i = next++)
+            {
+                GlyphImage &glyph = glyphs[i];
+                if (glyph.source.empty())
+                    continue;
+                DistanceField::Generate(&glyph.source[0], glyph.sourceWidth, glyph.sourceRows,
+                                        glyph.sourceWidth, glyph.offsetX, glyph.offsetY,
+                                        glyph.size.x, glyph.size.y,
+                                        TEXT_SDF_UPSAMPLE, TEXT_SDF_SPREAD, glyph.pixels);
+                vector<GLubyte>().swap(glyph.source);
+            }
+        };
+        size_t numThreads = min<size_t>(glyphs.size(), max(1u, std::thread::hardware_concurrency()));
+        vector<std::thread> helpers;
+        for (size_t i = 1; i < numThreads; i++)
+            helpers.push_back(std::thread(generate));
+        generate();
+        for (size_t i = 0; i < helpers.size(); i++)
+            helpers[i].join();
+    }
+
+    // Places a finished glyph on the current shelf of the atlas, starting a
+    // new shelf or doubling the atlas height when it doesn't fit. A pixel of
+    // padding keeps linear filtering from picking up a neighbour. Returns
+    // where the glyph went.
+    glm::ivec2 addGlyph(const GlyphImage &glyph)
+    {
+        const int padding = 1;
+        int width = glyph.size.x;
+        int rows = glyph.size.y;
+        glm::ivec2 offset(0, 0);
+
+        if (width > 0 && rows > 0 && width + 2 * padding <= TEXT_ATLAS_WIDTH)
+        {
+            // Start a new shelf when the glyph doesn't fit on this one
+            if (this->penX + width + padding > TEXT_ATLAS_WIDTH)
+            {
+                this->penX = padding;
+                this->penY += this->rowHeight + padding;
+                this->rowHeight = 0;
+            }
+            while (this->penY + rows + padding > this->atlasHeight)
+                this->atlasHeight *= 2;
+            this->atlasPixels.resize(TEXT_ATLAS_WIDTH * this->atlasHeight, 0);
+
+            for (int row = 0; row < rows; row++)
+                memcpy(&this->atlasPixels[(this->penY + row) * TEXT_ATLAS_WIDTH + this->penX],
+                       &glyph.pixels[row * width], width);
+
+            offset = glm::ivec2(this->penX, this->penY);
+            this->penX += width + padding;
+            if (rows > this->rowHeight)
+                this->rowHeight = rows;
+        }
+        else
+            width = rows = 0;
+
+        Character &character = this->pages[glyph.code / TEXT_PAGE_SIZE][glyph.code % TEXT_PAGE_SIZE];
+        character.Size = glm::ivec2(width, rows);
+        character.Bearing = glyph.bearing;
+        character.Advance = glyph.advance;
+        character.UVMin = glm::vec2(static_cast<GLfloat>(offset.x), static_cast<GLfloat>(offset.y));
+        character.UVMax = glm::vec2(static_cast<GLfloat>(offset.x + width), static_cast<GLfloat>(offset.y + rows));
+        character.State = GLYPH_READY;
+        return offset;
+    }
+
+    string cachePath()
+    {
+        return string(this->fontPath) + "." + to_string(this->pixelSize) + ".sdfcache";
+    }
+
+    // Size and modification time of the font, false if it can't be read
+    bool fontStamp(GLuint64 &size, GLint64 &time)
+    {
+        struct stat info;
+        if (stat(this->fontPath, &info) != 0)
+            return false;
+        size = (GLuint64)info.st_size;
+        time = (GLint64)info.st_mtime;
+        return true;
+    }
+
+    // Restores the glyphs, kerning and atlas of an earlier run, false when
+    // there is no cache or it was written for another font, size or build
+    bool loadCache(const string &path)
+    {
+        GLuint64 sourceSize;
+        GLint64 sourceTime;
+        if (!this->fontStamp(sourceSize, sourceTime))
+            return false;
+
+        ifstream in(path.c_str(), ios::in | ios::binary);
+        if (!in)
+            return false;
+
+        TextCacheHeader header;
+        if (!in.read((char *)&header, sizeof(header)) ||
+            memcmp(header.Magic, TEXT_CACHE_MAGIC, sizeof(header.Magic)) != 0 ||
+            header.Version != TEXT_CACHE_VERSION ||
+            header.CharacterSize != sizeof(Character) ||
+            header.PixelSize != this->pixelSize ||
+            header.Upsample != (GLuint)TEXT_SDF_UPSAMPLE ||
+            header.Spread != (GLuint)TEXT_SDF_SPREAD ||
+            header.AtlasWidth != (GLuint)TEXT_ATLAS_WIDTH ||
+            header.SourceSize != sourceSize || header.SourceTime != sourceTime)
+            return false;
+
+        vector<GLuint> codes(header.NumGlyphs);
+        vector<Character> glyphs(header.NumGlyphs);
+        vector<TextKerningPair> pairs(header.NumKerningPairs);
+        vector<GLubyte> pixels((size_t)header.AtlasWidth * header.AtlasHeight);
+        if (pixels.empty() ||
+            (!codes.empty() && !in.read((char *)&codes[0], codes.size() * sizeof(GLuint))) ||
+            (!glyphs.empty() && !in.read((char *)&glyphs[0], glyphs.size() * sizeof(Character))) ||
+            (!pairs.empty() && !in.read((char *)&pairs[0], pairs.size() * sizeof(TextKerningPair))) ||
+            !in.read((char *)&pixels[0], pixels.size()))
+            return false;
+        for (size_t i = 0; i < codes.size(); i++)
+            if (codes[i] > TEXT_MAX_CODEPOINT)
+                return false;
+
+        for (size_t i = 0; i < codes.size(); i++)
+        {
+            Character *&page = this->pages[codes[i] / TEXT_PAGE_SIZE];
+            if (page == NULL)
+                page = new Character[TEXT_PAGE_SIZE]();
+            page[codes[i] % TEXT_PAGE_SIZE] = glyphs[i];
+            page[codes[i] % TEXT_PAGE_SIZE].State = GLYPH_READY;
+        }
+        this->kerning.clear();
+        for (size_t i = 0; i < pairs.size(); i++)
+            this->kerning[pairs[i].Pair] = pairs[i].Amount;
+
+        this->atlasPixels.swap(pixels);
+        this->atlasHeight = (int)header.AtlasHeight;
+        this->penX = (int)header.PenX;
+        this->penY = (int)header.PenY;
+        this->rowHeight = (int)header.RowHeight;
+        return true;
+    }
+
+    // Writes to a temporary file first so a reader never sees half a cache
+    void writeCache(const string &path)
+    {
+        TextCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        if (!this->fontStamp(header.SourceSize, header.SourceTime))
+            return;
+
+        vector<GLuint> codes;
+        vector<Character> glyphs;
+        for (GLuint page = 0; page < TEXT_NUM_PAGES; page++)
+        {
+            if (this->pages[page] == NULL)
                 continue;
+            for (GLuint i = 0; i < TEXT_PAGE_SIZE; i++)
+            {
+                if (this->pages[page][i].State != GLYPH_READY)
+                    continue;
+                codes.push_back(page * TEXT_PAGE_SIZE + i);
+                glyphs.push_back(this->pages[page][i]);
             }
-            // Generate texture
-            GLuint texture;
-            glGenTextures(1, &texture);
-            glBindTexture(GL_TEXTURE_2D, texture);
-            glTexImage2D(
-                GL_TEXTURE_2D,
-                0,
-                GL_RED,
-                face->glyph->bitmap.width,
-                face->glyph->bitmap.rows,
-                0,
-                GL_RED,
-                GL_UNSIGNED_BYTE,
-                face->glyph->bitmap.buffer
-            );
-            // Set texture options
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            // Now store character for later use
-            Character character = {
-                texture,
-                glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows),
-                glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top),
-                face->glyph->advance.x
-             };
-            Characters.insert(std::pair<GLchar, Character>(c, character));
         }
-        glBindTexture(GL_TEXTURE_2D, 0);
-        // Destroy FreeType once we're finished
-        FT_Done_Face(face);
-        FT_Done_FreeType(ft);
 
+        vector<TextKerningPair> pairs;
+        pairs.reserve(this->kerning.size());
+        for (unordered_map<GLuint, FT_Pos>::const_iterator it = this->kerning.begin(); it != this->kerning.end(); ++it)
+        {
+            TextKerningPair pair = { it->first, (GLint)it->second };
+            pairs.push_back(pair);
+        }
 
-        // Configure VAO/VBO for texture quads
-        glGenVertexArrays(1, &this->VAO);
-        glGenBuffers(1, &this->VBO);
-        glBindVertexArray(this->VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+        memcpy(header.Magic, TEXT_CACHE_MAGIC, sizeof(header.Magic));
+        header.Version = TEXT_CACHE_VERSION;
+        header.CharacterSize = sizeof(Character);
+        header.NumGlyphs = (GLuint)codes.size();
+        header.PixelSize = this->pixelSize;
+        header.Upsample = TEXT_SDF_UPSAMPLE;
+        header.Spread = TEXT_SDF_SPREAD;
+        header.AtlasWidth = TEXT_ATLAS_WIDTH;
+        header.AtlasHeight = this->atlasHeight;
+        header.PenX = this->penX;
+        header.PenY = this->penY;
+        header.RowHeight = this->rowHeight;
+        header.NumKerningPairs = (GLuint)pairs.size();
+
+        string tempPath = path + ".tmp";
+        {
+            ofstream out(tempPath.c_str(), ios::out | ios::binary | ios::trunc);
+            if (!out)
+                return;
+            out.write((const char *)&header, sizeof(header));
+            if (!codes.empty())
+            {
+                out.write((const char *)&codes[0], codes.size() * sizeof(GLuint));
+                out.write((const char *)&glyphs[0], glyphs.size() * sizeof(Character));
+            }
+            if (!pairs.empty())
+                out.write((const char *)&pairs[0], pairs.size() * sizeof(TextKerningPair));
+            out.write((const char *)&this->atlasPixels[0], this->atlasPixels.size());
+            if (!out)
+            {
+                out.close();
+                remove(tempPath.c_str());
+                return;
+            }
+        }
+        if (rename(tempPath.c_str(), path.c_str()) != 0)
+            remove(tempPath.c_str());
+    }
+};
+
+// A string shaped once into a vertex buffer of its own. setText() lays the
+// string out again only when it changed, so between changes render() is a
+// single draw with no per-glyph work on the CPU. A string with glyphs still
+// being rasterized is shaped again once they are in the atlas. The Text
+// must outlive its layouts.
+class TextLayout {
+public:
+
+    TextLayout(Text &font, GLfloat scale = 1.0f)
+    {
+        this->font = &font;
+        this->scale = scale;
+        this->VAO = 0;
+        this->VBO = 0;
+        this->vboCapacity = 0;
+        this->vertexCount = 0;
+        this->width = 0.0f;
+        this->shaped = false;
+        this->complete = false;
+        this->generation = 0;
+    }
+
+    ~TextLayout()
+    {
+        if (this->VBO != 0)
+            glDeleteBuffers(1, &this->VBO);
+        if (this->VAO != 0)
+            glDeleteVertexArrays(1, &this->VAO);
+    }
+
+    void setText(const string &text)
+    {
+        if (this->shaped && text == this->text)
+            return;
+        this->text = text;
+        this->shape();
+    }
+
+    void setScale(GLfloat scale)
+    {
+        if (this->shaped && scale == this->scale)
+            return;
+        this->scale = scale;
+        this->shape();
+    }
+
+    const string &getText() const { return this->text; }
+    // Advance width of the whole string at the current scale
+    GLfloat getWidth() const { return this->width; }
+
+    void render(GLSLProgram &shader, GLfloat x, GLfloat y, glm::vec3 color)
+    {
+        if (this->shaped && !this->complete)
+        {
+            this->font->update();
+            if (this->font->generation != this->generation)
+                this->shape();
+        }
+        if (this->vertexCount > 0)
+            this->font->draw(shader, this->VAO, this->vertexCount, x, y, color);
+    }
+
+private:
+
+    Text *font;
+    string text;
+    GLfloat scale;
+    GLuint VAO, VBO;
+    GLsizeiptr vboCapacity;
+    GLsizei vertexCount;
+    GLfloat width;
+    bool shaped;
+    bool complete;          // Every glyph was in the atlas when shaped
+    GLuint generation;      // Atlas generation the layout was shaped against
+
+    void shape()
+    {
+        vector<GLfloat> vertices;
+        this->width = this->font->shape(this->text, this->scale, vertices, &this->complete);
+        this->generation = this->font->generation;
+        this->vertexCount = static_cast<GLsizei>(vertices.size() / 4);
+        this->shaped = true;
+        if (vertices.empty())
+            return;
+
+        if (this->VAO == 0)
+        {
+            this->vboCapacity = static_cast<GLsizeiptr>(vertices.size() * sizeof(GLfloat));
+            this->font->createVertexArray(this->VAO, this->VBO, this->vboCapacity);
+        }
+        this->font->uploadVertices(this->VBO, this->vboCapacity, vertices);
     }
 
+    // Non-copyable
+    TextLayout(const TextLayout &other) { }
+    TextLayout &operator=(const TextLayout &other) { return *this; }
 };
 
 
@@ -0,0 +1,239 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+    struct Stats {
+        double mean, min, max, p50, p95;
+    };
+
+    Stats computeStats( vector<double> samples )
+    {
+        Stats s = {0.0, 0.0, 0.0, 0.0, 0.0};
+        if( samples.empty() ) return s;
+
+        sort(samples.begin(), samples.end());
+        double sum = 0.0;
+        for( size_t i = 0; i < samples.size(); ++i )
+            sum += samples[i];
+
+        s.mean = sum / samples.size();
+        s.min = samples.front();
+        s.max = samples.back();
+        s.p50 = samples[(samples.size() - 1) / 2];
+        s.p95 = samples[(size_t)((samples.size() - 1) * 0.95)];
+        return s;
+    }
+
+    // A JSON string literal, quotes included. The driver strings are
+    // free text, so they may hold quotes, backslashes or control bytes.
+    string jsonString( const char * text )
+    {
+        string result = "\"";
+        for( const char * c = text; *c; ++c ) {
+            unsigned char byte = (unsigned char)*c;
+            if( byte == '"' || byte == '\\' ) {
+                result += '\\';
+                result += *c;
+            } else if( byte < 0x20 ) {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", byte);
+                result += escape;
+            } else {
+                result += *c;
+            }
+        }
+        return result + "\"";
+    }
+
+    void writeStats( ofstream & out, const char * key, const vector<double> & samples )
+    {
+        Stats s = computeStats(samples);
+        char buf[256];
+        snprintf(buf, sizeof(buf),
+                 "\"%s\": {\"samples\": %u, \"mean\": %.4f, \"min\": %.4f, "
+                 "\"max\": %.4f, \"p50\": %.4f, \"p95\": %.4f}",
+                 key, (unsigned)samples.size(), s.mean, s.min, s.max, s.p50, s.p95);
+        out << buf;
+    }
+}
+
+Benchmark::Benchmark(int numFrames, int warmupFrames, GLfloat timeStep) :
+    numFrames(numFrames), warmupFrames(warmupFrames), frame(0),
+    timeStep(timeStep), currentPass(-1), currentQuery(0), frameQuery(0)
+{
+    for( int i = 0; i < LATENCY; ++i )
+        slots[i].used = 0;
+
+    // Pass 0 is always the whole frame
+    passIndex("frame");
+}
+
+Benchmark::~Benchmark()
+{
+    for( int i = 0; i < LATENCY; ++i ) {
+        if( !slots[i].pool.empty() )
+            glDeleteQueries((GLsizei)slots[i].pool.size(), &slots[i].pool[0]);
+    }
+}
+
+int Benchmark::passIndex( const char * name )
+{
+    // There are only a handful of passes, a linear search is fine
+    for( size_t i = 0; i < passes.size(); ++i ) {
+        if( passes[i].name == name ) return (int)i;
+    }
+
+    PassRecord record;
+    record.name = name;
+    passes.push_back(record);
+    return (int)passes.size() - 1;
+}
+
+GLuint Benchmark::nextQuery( FrameSlot & slot )
+{
+    if( slot.used == slot.pool.size() ) {
+        GLuint query;
+        glGenQueries(1, &query);
+        slot.pool.push_back(query);
+    }
+    return slot.pool[slot.used++];
+}
+
+void Benchmark::collect( FrameSlot & slot )
+{
+    for( size_t i = 0; i < slot.pending.size(); ++i ) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(slot.pending[i].begin, GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(slot.pending[i].end, GL_QUERY_RESULT, &end);
+        passes[slot.pending[i].pass].gpuMs.push_back((end - begin) / 1.0e6);
+    }
+    slot.pending.clear();
+    slot.used = 0;
+}
+
+bool Benchmark::recording()
+{
+    return frame >= warmupFrames;
+}
+
+void Benchmark::beginFrame()
+{
+    // Results from LATENCY frames ago should be available by now
+    collect(slots[frame % LATENCY]);
+
+    frameStart = Clock::now();
+    frameQuery = nextQuery(slots[frame % LATENCY]);
+    glQueryCounter(frameQuery, GL_TIMESTAMP);
+}
+
+void Benchmark::endFrame()
+{
+    FrameSlot & slot = slots[frame % LATENCY];
+    GLuint query = nextQuery(slot);
+    glQueryCounter(query, GL_TIMESTAMP);
+    glFlush();
+
+    if( recording() ) {
+        chrono::duration<double, milli> elapsed = Clock::now() - frameStart;
+        passes[0].cpuMs.push_back(elapsed.count());
+
+        PendingQuery pending = {0, frameQuery, query};
+        slot.pending.push_back(pending);
+    }
+
+    ++frame;
+}
+
+void Benchmark::beginPass( const char * name )
+{
+    currentPass = passIndex(name);
+    currentQuery = nextQuery(slots[frame % LATENCY]);
+    glQueryCounter(currentQuery, GL_TIMESTAMP);
+    passStart = Clock::now();
+}
+
+void Benchmark::endPass()
+{
+    if( currentPass < 0 ) return;
+
+    chrono::duration<double, milli> elapsed = Clock::now() - passStart;
+
+    FrameSlot & slot = slots[frame % LATENCY];
+    GLuint query = nextQuery(slot);
+    glQueryCounter(query, GL_TIMESTAMP);
+
+    if( recording() ) {
+        passes[currentPass].cpuMs.push_back(elapsed.count());
+
+        PendingQuery pending = {currentPass, currentQuery, query};
+        slot.pending.push_back(pending);
+    }
+
+    currentPass = -1;
+}
+
+bool Benchmark::isFinished()
+{
+    return frame >= numFrames + warmupFrames;
+}
+
+int Benchmark::getFrame()
+{
+    return frame;
+}
+
+GLfloat Benchmark::getTime()
+{
+    return frame * timeStep;
+}
+
+void Benchmark::cameraPath( GLfloat time, glm::vec3 & position, glm::vec3 & target )
+{
+    // One orbit every 20 seconds, bobbing between floor and lamp height
+    GLfloat angle = time * 6.28318531f / 20.0f;
+    position = glm::vec3(6.0f * cos(angle), 1.0f + 1.5f * sin(angle * 2.0f),
+                         6.0f * sin(angle));
+    target = glm::vec3(0.0f, 0.0f, 0.0f);
+}
+
+void Benchmark::writeReport( const char * path, int width, int height )
+{
+    for( int i = 0; i < LATENCY; ++i )
+        collect(slots[i]);
+
+    ofstream out(path);
+    if( !out ) {
+        cerr << "Unable to write benchmark report: " << path << endl;
+        return;
+    }
+
+    const GLubyte * renderer = glGetString(GL_RENDERER);
+    const GLubyte * version = glGetString(GL_VERSION);
+
+    out << "{\n";
+    out << "  \"renderer\": " << jsonString(renderer ? (const char *)renderer : "") << ",\n";
+    out << "  \"version\": " << jsonString(version ? (const char *)version : "") << ",\n";
+    out << "  \"width\": " << width << ",\n";
+    out << "  \"height\": " << height << ",\n";
+    out << "  \"frames\": " << numFrames << ",\n";
+    out << "  \"warmup_frames\": " << warmupFrames << ",\n";
+    out << "  \"passes\": [\n";
+    for( size_t i = 0; i < passes.size(); ++i ) {
+        out << "    {\"name\": " << jsonString(passes[i].name.c_str()) << ", ";
+        writeStats(out, "cpu_ms", passes[i].cpuMs);
+        out << ", ";
+        writeStats(out, "gpu_ms", passes[i].gpuMs);
+        out << "}" << (i + 1 < passes.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+
+    cout << "Benchmark report written to " << path << endl;
+}
@@ -0,0 +1,86 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "cookbookogl.h"
+
+#include <string>
+using std::string;
+#include <vector>
+#include <chrono>
+
+#include <glm/glm.hpp>
+
+// Runs the render loop for a fixed number of frames and collects CPU and
+// GPU timings for each named pass. GPU timings come from GL_TIMESTAMP
+// queries which are read back a few frames late so the measurement never
+// stalls the pipeline. The results are written out as JSON.
+class Benchmark
+{
+  private:
+    static const int LATENCY = 4;
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct PassRecord {
+        string name;
+        std::vector<double> cpuMs;
+        std::vector<double> gpuMs;
+    };
+
+    struct PendingQuery {
+        int pass;
+        GLuint begin, end;
+    };
+
+    struct FrameSlot {
+        std::vector<GLuint> pool;
+        size_t used;
+        std::vector<PendingQuery> pending;
+    };
+
+    int numFrames, warmupFrames;
+    int frame;
+    GLfloat timeStep;
+
+    std::vector<PassRecord> passes;
+    FrameSlot slots[LATENCY];
+
+    int currentPass;
+    GLuint currentQuery;
+    Clock::time_point passStart, frameStart;
+    GLuint frameQuery;
+
+    int    passIndex( const char * name );
+    GLuint nextQuery( FrameSlot & slot );
+    void   collect( FrameSlot & slot );
+    bool   recording();
+
+    // Non-copyable
+    Benchmark( const Benchmark & other ) { }
+    Benchmark & operator=( const Benchmark &other ) { return *this; }
+
+  public:
+    Benchmark(int numFrames, int warmupFrames = 10, GLfloat timeStep = 1.0f / 60.0f);
+    ~Benchmark();
+
+    void    beginFrame();
+    void    endFrame();
+    void    beginPass( const char * name );
+    void    endPass();
+
+    bool    isFinished();
+    int     getFrame();
+
+    // Simulated time of the current frame. Advances by a fixed step so the
+    // animation, and therefore the work per frame, is identical every run.
+    GLfloat getTime();
+
+    // Scripted camera path: a slow orbit around the scene that sweeps
+    // through the lamps and the diamond grid.
+    static void cameraPath( GLfloat time, glm::vec3 & position, glm::vec3 & target );
+
+    // Waits for the outstanding queries and writes the report.
+    void    writeReport( const char * path, int width, int height );
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,257 @@
+#include "cascadedshadowmap.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+    // Step a cascade moves in while its static layer is cached, and the
+    // margin it gets for that, as a fraction of the slice's bounding radius
+    const float STATIC_STEP = 0.25f;
+}
+
+CascadedShadowMap::CascadedShadowMap() : fbo(0), depthTexture(0), staticTexture(0), numCascades(0),
+    resolution(0), lambda(0.75f), casterDistance(20.0f), lightDirection(0.0f, -1.0f, 0.0f),
+    staticCaching(false)
+{
+    for( int i = 0; i < MAX_CASCADES; ++i ) {
+        splits[i] = 0.0f;
+        depthBias[i] = 0.0f;
+        radius[i] = 0.0f;
+        staticValid[i] = false;
+    }
+}
+
+CascadedShadowMap::~CascadedShadowMap()
+{
+    if( depthTexture != 0 )
+        glDeleteTextures(1, &depthTexture);
+    if( staticTexture != 0 )
+        glDeleteTextures(1, &staticTexture);
+    if( fbo != 0 )
+        glDeleteFramebuffers(1, &fbo);
+}
+
+void CascadedShadowMap::create( int numCascades, GLsizei resolution )
+{
+    this->numCascades = glm::clamp(numCascades, 1, (int)MAX_CASCADES);
+    this->resolution = resolution;
+
+    createDepthArray(depthTexture);
+    createDepthArray(staticTexture);
+    invalidateStatic();
+
+    GLint previous = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+    if( fbo == 0 )
+        glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if( glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE )
+        cerr << "Cascaded shadow map framebuffer is not complete" << endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, previous);
+}
+
+void CascadedShadowMap::createDepthArray( GLuint & texture )
+{
+    if( texture == 0 )
+        glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, resolution, resolution,
+                 this->numCascades, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // Anything outside a cascade reads as unshadowed
+    GLfloat border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void CascadedShadowMap::setSplitLambda( float lambda )
+{
+    this->lambda = glm::clamp(lambda, 0.0f, 1.0f);
+}
+
+void CascadedShadowMap::setCasterDistance( float distance )
+{
+    casterDistance = distance;
+}
+
+void CascadedShadowMap::update( const mat4 & view, float fovy, float aspect, float nearPlane,
+                                float shadowDistance, const vec3 & direction )
+{
+    lightDirection = glm::normalize(direction);
+
+    // The light's orientation never depends on the camera, only the
+    // projections move, which is what lets them snap to texels
+    vec3 up = fabs(lightDirection.y) > 0.99f ? vec3(0.0f, 0.0f, 1.0f) : vec3(0.0f, 1.0f, 0.0f);
+    lightView = glm::lookAt(vec3(0.0f), lightDirection, up);
+
+    mat4 viewToWorld = glm::inverse(view);
+    float tanY = tanf(fovy * 0.5f);
+    float tanX = tanY * aspect;
+
+    float sliceNear = nearPlane;
+    for( int i = 0; i < numCascades; ++i ) {
+        // Practical split scheme
+        float p = (float)(i + 1) / numCascades;
+        float logSplit = nearPlane * powf(shadowDistance / nearPlane, p);
+        float uniformSplit = nearPlane + (shadowDistance - nearPlane) * p;
+        float sliceFar = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+        splits[i] = sliceFar;
+
+        // Corners of the slice in world space
+        vec3 corners[8];
+        int k = 0;
+        for( int n = 0; n < 2; ++n ) {
+            float d = n == 0 ? sliceNear : sliceFar;
+            for( int sx = -1; sx <= 1; sx += 2 )
+                for( int sy = -1; sy <= 1; sy += 2 )
+                    corners[k++] = vec3(viewToWorld * glm::vec4(sx * d * tanX, sy * d * tanY, -d, 1.0f));
+        }
+
+        // The bounding sphere is the same however the camera turns; rounding
+        // its radius keeps float noise from changing the texel size
+        vec3 sphereCenter(0.0f);
+        for( int c = 0; c < 8; ++c )
+            sphereCenter += corners[c];
+        sphereCenter /= 8.0f;
+        float r = 0.0f;
+        for( int c = 0; c < 8; ++c )
+            r = glm::max(r, glm::length(corners[c] - sphereCenter));
+        r = ceilf(r * 16.0f) / 16.0f;
+
+        // Move the projection in whole texels only. When the static layer is
+        // cached it moves in steps of about a quarter of the slice instead,
+        // and covers that much more, so the camera moving within a step keeps
+        // the exact same matrix and the static layer stays valid.
+        float extent = staticCaching ? r * (1.0f + STATIC_STEP) : r;
+        float texel = 2.0f * extent / resolution;
+        float step = staticCaching ? glm::max(floorf(r * STATIC_STEP / texel), 1.0f) * texel : texel;
+        vec3 lightCenter = vec3(lightView * glm::vec4(sphereCenter, 1.0f));
+        lightCenter.x = floorf(lightCenter.x / step) * step;
+        lightCenter.y = floorf(lightCenter.y / step) * step;
+        lightCenter.z = floorf(lightCenter.z / step) * step;
+        r = extent;
+        center[i] = lightCenter;
+        radius[i] = r;
+
+        // The light looks down -z. Casters between the slice and the light
+        // are kept up to casterDistance away.
+        float zNear = -(lightCenter.z + r + casterDistance);
+        float zFar = -(lightCenter.z - r);
+        mat4 projection = glm::ortho(lightCenter.x - r, lightCenter.x + r,
+                                     lightCenter.y - r, lightCenter.y + r, zNear, zFar);
+        lightSpace[i] = projection * lightView;
+        depthBias[i] = 2.0f * texel / (zFar - zNear);
+
+        if( staticValid[i] && lightSpace[i] != staticLightSpace[i] )
+            staticValid[i] = false;
+
+        sliceNear = sliceFar;
+    }
+}
+
+void CascadedShadowMap::beginCascade( int cascade )
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, cascade);
+    glViewport(0, 0, resolution, resolution);
+    if( isStaticCached(cascade) )
+        glCopyImageSubData(staticTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascade,
+                           depthTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascade,
+                           resolution, resolution, 1);
+    else
+        glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void CascadedShadowMap::setStaticCaching( bool enabled )
+{
+    staticCaching = enabled;
+    invalidateStatic();
+}
+
+bool CascadedShadowMap::needsStaticUpdate( int cascade )
+{
+    return staticCaching && !staticValid[cascade];
+}
+
+void CascadedShadowMap::beginStaticCascade( int cascade )
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticTexture, 0, cascade);
+    glViewport(0, 0, resolution, resolution);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    staticValid[cascade] = true;
+    staticLightSpace[cascade] = lightSpace[cascade];
+}
+
+bool CascadedShadowMap::isStaticCached( int cascade )
+{
+    return staticCaching && staticValid[cascade];
+}
+
+void CascadedShadowMap::invalidateStatic()
+{
+    for( int i = 0; i < MAX_CASCADES; ++i )
+        staticValid[i] = false;
+}
+
+bool CascadedShadowMap::isVisible( int cascade, const vec3 & sphereCenter, float sphereRadius )
+{
+    vec3 d = vec3(lightView * glm::vec4(sphereCenter, 1.0f)) - center[cascade];
+    float extent = radius[cascade] + sphereRadius;
+    if( fabs(d.x) > extent || fabs(d.y) > extent )
+        return false;
+    // Behind the slice, or further towards the light than casters are kept
+    return d.z >= -extent && d.z <= extent + casterDistance;
+}
+
+void CascadedShadowMap::bindTexture( GLuint unit )
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+}
+
+int CascadedShadowMap::getNumCascades()
+{
+    return numCascades;
+}
+
+GLuint CascadedShadowMap::getTexture()
+{
+    return depthTexture;
+}
+
+const mat4 * CascadedShadowMap::getLightSpaceMatrices()
+{
+    return lightSpace;
+}
+
+const mat4 & CascadedShadowMap::getLightSpaceMatrix( int cascade )
+{
+    return lightSpace[cascade];
+}
+
+const float * CascadedShadowMap::getSplits()
+{
+    return splits;
+}
+
+const float * CascadedShadowMap::getDepthBias()
+{
+    return depthBias;
+}
+
+const vec3 & CascadedShadowMap::getLightDirection()
+{
+    return lightDirection;
+}
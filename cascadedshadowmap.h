@@ -0,0 +1,107 @@
+#ifndef CASCADEDSHADOWMAP_H
+#define CASCADEDSHADOWMAP_H
+
+#include "cookbookogl.h"
+
+#include <glm/glm.hpp>
+using glm::vec3;
+using glm::mat4;
+
+// Shadows of a directional light split over several depth maps (cascades),
+// each covering one slice of the camera frustum. The slices follow the
+// practical split scheme, a blend of logarithmic and uniform splits, so the
+// slices near the camera get more texels per unit of depth.
+//
+// Each cascade is a layer of one depth texture array. Its light projection
+// is fitted to a bounding sphere of the slice and snapped to whole texels,
+// so shadow edges stay put while the camera moves and turns.
+//
+// Casters that never move can be drawn into a second, cached array: a
+// cascade's static layer is redrawn only when its projection changes or
+// invalidateStatic() is called, and each frame starts from a copy of it
+// before the moving casters are drawn on top. The copy is a whole layer a
+// frame, so this only pays when the static casters are expensive to draw;
+// while caching, projections move in coarse steps to keep the layer valid
+// as the camera moves, at the cost of some resolution.
+class CascadedShadowMap
+{
+  public:
+    static const int MAX_CASCADES = 4;
+
+  private:
+    GLuint fbo;
+    GLuint depthTexture;
+    GLuint staticTexture;
+    int numCascades;
+    GLsizei resolution;
+    float lambda;               // 0 uniform splits, 1 logarithmic
+    float casterDistance;       // How far beyond a slice casters are looked for
+
+    vec3 lightDirection;
+    mat4 lightView;
+    mat4 lightSpace[MAX_CASCADES];
+    float splits[MAX_CASCADES];     // View space far distance of each slice
+    float depthBias[MAX_CASCADES];  // About two texels, in depth map units
+
+    // Light view space bounds of each cascade, for culling
+    vec3 center[MAX_CASCADES];
+    float radius[MAX_CASCADES];
+
+    bool staticCaching;
+    bool staticValid[MAX_CASCADES];
+    mat4 staticLightSpace[MAX_CASCADES];    // Projection the static layer was drawn with
+
+    void   createDepthArray( GLuint & texture );
+
+    // Non-copyable
+    CascadedShadowMap( const CascadedShadowMap & other ) { }
+    CascadedShadowMap & operator=( const CascadedShadowMap &other ) { return *this; }
+
+  public:
+    CascadedShadowMap();
+    ~CascadedShadowMap();
+
+    void   create( int numCascades = MAX_CASCADES, GLsizei resolution = 1024 );
+
+    void   setSplitLambda( float lambda );
+    void   setCasterDistance( float distance );
+
+    // Fits the cascades to the camera frustum from nearPlane to shadowDistance.
+    // direction is the way the light shines.
+    void   update( const mat4 & view, float fovy, float aspect, float nearPlane,
+                   float shadowDistance, const vec3 & direction );
+
+    // Binds the framebuffer to one cascade's layer with a matching viewport.
+    // The layer starts as a copy of the static layer when that is cached and
+    // cleared otherwise. The caller restores its own framebuffer afterwards.
+    void   beginCascade( int cascade );
+
+    // Static caster caching, off by default
+    void   setStaticCaching( bool enabled );
+    // Whether the static casters have to be drawn into a cascade's static
+    // layer before beginCascade()
+    bool   needsStaticUpdate( int cascade );
+    // Binds and clears the static layer of a cascade, which counts as
+    // cached from then on
+    void   beginStaticCascade( int cascade );
+    // Whether beginCascade() starts from the static casters, if not the
+    // caller draws them along with the moving ones
+    bool   isStaticCached( int cascade );
+    // Call when static casters are added, removed or moved
+    void   invalidateStatic();
+
+    // Whether a bounding sphere can cast a shadow into a cascade
+    bool   isVisible( int cascade, const vec3 & sphereCenter, float sphereRadius );
+
+    void   bindTexture( GLuint unit );
+
+    int    getNumCascades();
+    GLuint getTexture();
+    const mat4 * getLightSpaceMatrices();
+    const mat4 & getLightSpaceMatrix( int cascade );
+    const float * getSplits();
+    const float * getDepthBias();
+    const vec3 & getLightDirection();
+};
+
+#endif // CASCADEDSHADOWMAP_H
@@ -0,0 +1,80 @@
+#include "gbuffer.h"
+
+#include <iostream>
+
+using namespace std;
+
+GBuffer::GBuffer() : fbo(0), diffuseTexture(0), specularTexture(0), normalTexture(0),
+    depthTexture(0), width(0), height(0)
+{
+}
+
+GBuffer::~GBuffer()
+{
+    GLuint textures[] = { diffuseTexture, specularTexture, normalTexture, depthTexture };
+    for( int i = 0; i < 4; ++i )
+        if( textures[i] != 0 )
+            glDeleteTextures(1, &textures[i]);
+    if( fbo != 0 )
+        glDeleteFramebuffers(1, &fbo);
+}
+
+GLuint GBuffer::createTarget( GLenum internalFormat, GLenum format, GLenum type )
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+void GBuffer::create( GLsizei width, GLsizei height )
+{
+    this->width = width;
+    this->height = height;
+
+    diffuseTexture = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+    specularTexture = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+    normalTexture = createTarget(GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV);
+    depthTexture = createTarget(GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint previous = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+    if( fbo == 0 )
+        glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, diffuseTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, specularTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, normalTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+    GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+    glDrawBuffers(3, drawBuffers);
+    if( glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE )
+        cerr << "G-buffer framebuffer is not complete" << endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, previous);
+}
+
+void GBuffer::bind()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+
+    GLfloat clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for( GLint i = 0; i < 3; ++i )
+        glClearBufferfv(GL_COLOR, i, clearColor);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void GBuffer::bindTextures( GLuint firstUnit )
+{
+    GLuint textures[] = { diffuseTexture, specularTexture, normalTexture, depthTexture };
+    for( GLuint i = 0; i < 4; ++i ) {
+        glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+    }
+}
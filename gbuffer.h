@@ -0,0 +1,44 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include "cookbookogl.h"
+
+// Render targets of the deferred path's geometry pass, 12 bytes of
+// material and normal per pixel plus depth:
+//   0 diffuse   RGBA8     colour, a ambient to diffuse ratio / 4
+//   1 specular  RGBA8     colour, a log2(shininess) / 8
+//   2 normal    RGB10_A2  octahedral normal in rg, b gamma correct, a surface flags
+// The lighting pass reads them back with texelFetch and rebuilds the
+// world position from depth.
+class GBuffer
+{
+  private:
+    GLuint fbo;
+    GLuint diffuseTexture;
+    GLuint specularTexture;
+    GLuint normalTexture;
+    GLuint depthTexture;
+    GLsizei width;
+    GLsizei height;
+
+    GLuint createTarget( GLenum internalFormat, GLenum format, GLenum type );
+
+    // Non-copyable
+    GBuffer( const GBuffer & other ) { }
+    GBuffer & operator=( const GBuffer &other ) { return *this; }
+
+  public:
+    GBuffer();
+    ~GBuffer();
+
+    void   create( GLsizei width, GLsizei height );
+
+    // Binds the framebuffer with a matching viewport and clears it. The
+    // caller restores its own framebuffer afterwards.
+    void   bind();
+
+    // Diffuse, specular, normal and depth on consecutive units
+    void   bindTextures( GLuint firstUnit );
+};
+
+#endif // GBUFFER_H
@@ -6,11 +6,14 @@
 using std::ifstream;
 using std::ios;
 
-#include <sstream>
-#include <string>
+#include <sstream>
+#include <string>
+#include <vector>
 #include <iostream>
-#include <sys/stat.h>
-
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
 using namespace std;
 
 namespace GLSLShaderInfo {
@@ -29,11 +32,86 @@ namespace GLSLShaderInfo {
     {".tes", GLSLShader::TESS_EVALUATION},
     {".fs", GLSLShader::FRAGMENT},
     {".frag", GLSLShader::FRAGMENT},
-    {".cs", GLSLShader::COMPUTE}
+    {".cs", GLSLShader::COMPUTE},
+    {".comp", GLSLShader::COMPUTE}
+  };
+}
+
+namespace GLSLBinaryCache {
+  const char MAGIC[4] = {'G', 'L', 'P', 'B'};
+  const GLuint VERSION = 1;
+
+  struct header {
+    char magic[4];
+    GLuint version;
+    GLuint64 key;
+    GLenum format;
+    GLint length;
   };
+
+  // 64-bit FNV-1a, chained through the previous hash
+  GLuint64 hash( const char * data, size_t length, GLuint64 h = 14695981039346656037ULL )
+  {
+    for( size_t i = 0; i < length; i++ ) {
+      h ^= (unsigned char)data[i];
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  GLuint64 hash( const string & str, GLuint64 h )
+  {
+    // Include the length so "ab"+"c" and "a"+"bc" differ
+    size_t length = str.length();
+    h = hash((const char *)&length, sizeof(length), h);
+    return hash(str.c_str(), length, h);
+  }
+}
+
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+string GLSLProgram::binaryCacheDir = "shadercache";
+int GLSLProgram::parallelCompile = -1;
+
+GLSLDefines & GLSLDefines::set( const string & name, int value )
+{
+  return set(name, std::to_string(value));
+}
+
+GLSLDefines & GLSLDefines::set( const string & name, const string & value )
+{
+  values[name] = value;
+  return *this;
+}
+
+bool GLSLDefines::empty() const
+{
+  return values.empty();
+}
+
+string GLSLDefines::preamble() const
+{
+  string text;
+  for( std::map<string, string>::const_iterator it = values.begin(); it != values.end(); ++it )
+    text += "#define " + it->first + " " + it->second + "\n";
+  return text;
+}
+
+string GLSLDefines::key() const
+{
+  string text;
+  for( std::map<string, string>::const_iterator it = values.begin(); it != values.end(); ++it )
+    text += it->first + "=" + it->second + ";";
+  return text;
 }
 
-GLSLProgram::GLSLProgram() : handle(0), linked(false) { }
+GLSLProgram::GLSLProgram() : handle(0), linked(false), fromBinaryCache(false),
+  pending(false), pendingCacheKey(0) { }
 
 GLSLProgram::~GLSLProgram() {
   if(handle == 0) return;
@@ -55,19 +133,389 @@ GLSLProgram::~GLSLProgram() {
 
   delete[] shaderNames;
 }
-
-void GLSLProgram::init(const char* vertexPath, const char* fragmentPath)
-{
-    try {
-       compileShader(vertexPath);
-       compileShader(fragmentPath);
-       link();
-       validate();
-    }
-    catch( GLSLProgramException &e ) {
-        cerr << e.what() << endl;   exit(EXIT_FAILURE);
-    }
-}
+
+void GLSLProgram::init(const char* vertexPath, const char* fragmentPath)
+{
+    try {
+       string vertexSource = readSource(vertexPath);
+       string fragmentSource = readSource(fragmentPath);
+
+       string cachePath;
+       GLuint64 cacheKey = 0;
+       if( !binaryCacheDir.empty() ) {
+         cachePath = binaryCachePath(vertexPath, fragmentPath);
+         cacheKey = binaryCacheKey(vertexSource, fragmentSource);
+
+         if( loadBinary(cachePath, cacheKey) )
+           return;
+       }
+
+       compileShader(vertexSource, GLSLShader::VERTEX, vertexPath);
+       compileShader(fragmentSource, GLSLShader::FRAGMENT, fragmentPath);
+       if( !cachePath.empty() )
+         glProgramParameteri(handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+       link();
+
+       if( !cachePath.empty() )
+         saveBinary(cachePath, cacheKey);
+    }
+    catch( GLSLProgramException &e ) {
+        cerr << e.what() << endl;   exit(EXIT_FAILURE);
+    }
+}
+
+void GLSLProgram::initAsync(const char* vertexPath, const char* fragmentPath)
+{
+    initAsync(vertexPath, NULL, fragmentPath);
+}
+
+void GLSLProgram::initAsync(const char* vertexPath, const char* geometryPath,
+                            const char* fragmentPath)
+{
+    try {
+       string vertexSource = readSource(vertexPath);
+       string geometrySource = geometryPath ? readSource(geometryPath) : string();
+       string fragmentSource = readSource(fragmentPath);
+
+       if( !binaryCacheDir.empty() ) {
+         pendingCachePath = binaryCachePath(vertexPath, fragmentPath, geometryPath);
+         pendingCacheKey = binaryCacheKey(vertexSource, fragmentSource, geometrySource);
+
+         if( loadBinary(pendingCachePath, pendingCacheKey) ) {
+           pendingCachePath.clear();
+           return;
+         }
+       }
+
+       // Let the driver use as many compiler threads as it likes
+       hasParallelCompile();
+
+       if( handle <= 0 ) {
+         handle = glCreateProgram();
+         if( handle == 0 )
+           throw GLSLProgramException("Unable to create shader program.");
+       }
+
+       submitShader(vertexSource, GLSLShader::VERTEX, vertexPath);
+       if( geometryPath )
+         submitShader(geometrySource, GLSLShader::GEOMETRY, geometryPath);
+       submitShader(fragmentSource, GLSLShader::FRAGMENT, fragmentPath);
+       if( !pendingCachePath.empty() )
+         glProgramParameteri(handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+       // No status queries here, they would make the driver finish the work
+       glLinkProgram(handle);
+       pending = true;
+    }
+    catch( GLSLProgramException &e ) {
+        cerr << e.what() << endl;   exit(EXIT_FAILURE);
+    }
+}
+
+void GLSLProgram::initComputeAsync(const char* computePath)
+{
+    try {
+       string computeSource = readSource(computePath);
+
+       if( !binaryCacheDir.empty() ) {
+         pendingCachePath = binaryCachePath(computePath, "");
+         pendingCacheKey = binaryCacheKey(computeSource, string());
+
+         if( loadBinary(pendingCachePath, pendingCacheKey) ) {
+           pendingCachePath.clear();
+           return;
+         }
+       }
+
+       hasParallelCompile();
+
+       if( handle <= 0 ) {
+         handle = glCreateProgram();
+         if( handle == 0 )
+           throw GLSLProgramException("Unable to create shader program.");
+       }
+
+       submitShader(computeSource, GLSLShader::COMPUTE, computePath);
+       if( !pendingCachePath.empty() )
+         glProgramParameteri(handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+       glLinkProgram(handle);
+       pending = true;
+    }
+    catch( GLSLProgramException &e ) {
+        cerr << e.what() << endl;   exit(EXIT_FAILURE);
+    }
+}
+
+void GLSLProgram::submitShader( const string & source,
+    GLSLShader::GLSLShaderType type, const char * fileName )
+{
+  GLuint shaderHandle = glCreateShader(type);
+
+  const char * c_code = source.c_str();
+  glShaderSource( shaderHandle, 1, &c_code, NULL );
+  glCompileShader(shaderHandle);
+  glAttachShader(handle, shaderHandle);
+
+  PendingShader shader = {shaderHandle, fileName};
+  pendingShaders.push_back(shader);
+}
+
+// Collects the results of an initAsync: compile logs, link status and
+// validation. Mirrors the checks compileShader and link do synchronously.
+void GLSLProgram::finishAsync() throw(GLSLProgramException)
+{
+  pending = false;
+
+  for( size_t i = 0; i < pendingShaders.size(); i++ ) {
+    int result;
+    GLuint shaderHandle = pendingShaders[i].handle;
+    glGetShaderiv( shaderHandle, GL_COMPILE_STATUS, &result );
+    if( GL_FALSE == result ) {
+      int length = 0;
+      string logString;
+      glGetShaderiv(shaderHandle, GL_INFO_LOG_LENGTH, &length );
+      if( length > 0 ) {
+        char * c_log = new char[length];
+        int written = 0;
+        glGetShaderInfoLog(shaderHandle, length, &written, c_log);
+        logString = c_log;
+        delete [] c_log;
+      }
+      throw GLSLProgramException(pendingShaders[i].fileName +
+                                 ": shader compliation failed\n" + logString);
+    }
+  }
+  pendingShaders.clear();
+
+  int status = 0;
+  glGetProgramiv( handle, GL_LINK_STATUS, &status);
+  if( GL_FALSE == status ) {
+    int length = 0;
+    string logString;
+
+    glGetProgramiv(handle, GL_INFO_LOG_LENGTH, &length );
+
+    if( length > 0 ) {
+      char * c_log = new char[length];
+      int written = 0;
+      glGetProgramInfoLog(handle, length, &written, c_log);
+      logString = c_log;
+      delete [] c_log;
+    }
+
+    throw GLSLProgramException(string("Program link failed:\n") + logString);
+  }
+
+  linked = true;
+  buildUniformTable();
+
+  for( size_t i = 0; i < pendingBlockBindings.size(); i++ )
+    bindUniformBlock(pendingBlockBindings[i].first.c_str(), pendingBlockBindings[i].second);
+  pendingBlockBindings.clear();
+
+  if( !pendingCachePath.empty() ) {
+    saveBinary(pendingCachePath, pendingCacheKey);
+    pendingCachePath.clear();
+  }
+}
+
+bool GLSLProgram::hasParallelCompile()
+{
+  if( parallelCompile < 0 ) {
+    parallelCompile = 0;
+
+    GLint nExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &nExtensions);
+    for( int i = 0; i < nExtensions; i++ ) {
+      const char * ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+      if( strcmp(ext, "GL_KHR_parallel_shader_compile") == 0 ||
+          strcmp(ext, "GL_ARB_parallel_shader_compile") == 0 ) {
+        parallelCompile = 1;
+        break;
+      }
+    }
+
+    if( parallelCompile ) {
+      typedef void (CODEGEN_FUNCPTR *MaxThreadsProc)(GLuint count);
+      MaxThreadsProc maxThreads =
+        (MaxThreadsProc) GLUtils::getProcAddress("glMaxShaderCompilerThreadsKHR");
+      if( !maxThreads )
+        maxThreads = (MaxThreadsProc) GLUtils::getProcAddress("glMaxShaderCompilerThreadsARB");
+      if( maxThreads )
+        maxThreads(0xFFFFFFFF);
+    }
+  }
+  return parallelCompile == 1;
+}
+
+void GLSLProgram::resolve()
+{
+  if( !pending ) return;
+
+  try {
+    finishAsync();
+  }
+  catch( GLSLProgramException &e ) {
+    cerr << e.what() << endl;   exit(EXIT_FAILURE);
+  }
+
+  runReady();
+}
+
+// Validation checks the sampler units, which until the callback has set
+// them all read unit 0, and a program mixing sampler types fails on that.
+void GLSLProgram::runReady()
+{
+  if( !readyCallback ) return;
+  readyCallback(*this);
+
+  try {
+    validate();
+  }
+  catch( GLSLProgramException &e ) {
+    cerr << e.what() << endl;   exit(EXIT_FAILURE);
+  }
+}
+
+bool GLSLProgram::isReady()
+{
+  if( pending ) {
+    if( hasParallelCompile() ) {
+      GLint done = GL_FALSE;
+      glGetProgramiv(handle, GL_COMPLETION_STATUS_KHR, &done);
+      if( GL_FALSE == done ) return false;
+    }
+    resolve();
+  }
+  return linked;
+}
+
+void GLSLProgram::wait()
+{
+  // The link status query blocks until the driver is done
+  resolve();
+}
+
+void GLSLProgram::onReady( std::function<void(GLSLProgram &)> callback )
+{
+  readyCallback = callback;
+  if( !pending && linked ) runReady();
+}
+
+void GLSLProgram::setBinaryCacheDir( const string & dir )
+{
+  binaryCacheDir = dir;
+}
+
+bool GLSLProgram::isFromBinaryCache()
+{
+  return fromBinaryCache;
+}
+
+// One cache file per program, so a stale entry is overwritten rather
+// than left behind when the sources change.
+string GLSLProgram::binaryCachePath( const char * vertexPath, const char * fragmentPath,
+    const char * geometryPath )
+{
+  GLuint64 h = GLSLBinaryCache::hash(string(vertexPath), 14695981039346656037ULL);
+  h = GLSLBinaryCache::hash(string(fragmentPath), h);
+  if( geometryPath )
+    h = GLSLBinaryCache::hash(string(geometryPath), h);
+  if( !defines.empty() )
+    h = GLSLBinaryCache::hash(defines.key(), h);
+
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)h);
+  return binaryCacheDir + "/" + name;
+}
+
+// The key covers everything that makes a binary unusable: the exact
+// source text that is compiled (so any injected #defines too) and the
+// driver that produced it.
+GLuint64 GLSLProgram::binaryCacheKey( const string & vertexSource, const string & fragmentSource,
+    const string & geometrySource )
+{
+  const GLenum driverStrings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+
+  GLuint64 h = 14695981039346656037ULL;
+  for( int i = 0; i < 3; i++ ) {
+    const GLubyte * str = glGetString(driverStrings[i]);
+    h = GLSLBinaryCache::hash(string(str ? (const char *)str : ""), h);
+  }
+  h = GLSLBinaryCache::hash(vertexSource, h);
+  h = GLSLBinaryCache::hash(fragmentSource, h);
+  if( !geometrySource.empty() )
+    h = GLSLBinaryCache::hash(geometrySource, h);
+  return h;
+}
+
+bool GLSLProgram::loadBinary( const string & path, GLuint64 key )
+{
+  ifstream inFile( path.c_str(), ios::in | ios::binary );
+  if( !inFile ) return false;
+
+  GLSLBinaryCache::header header;
+  if( !inFile.read((char *)&header, sizeof(header)) ||
+      memcmp(header.magic, GLSLBinaryCache::MAGIC, 4) != 0 ||
+      header.version != GLSLBinaryCache::VERSION ||
+      header.key != key || header.length <= 0 )
+    return false;
+
+  std::vector<char> binary(header.length);
+  if( !inFile.read(&binary[0], header.length) ) return false;
+
+  if( handle <= 0 ) {
+    handle = glCreateProgram();
+    if( handle == 0 ) return false;
+  }
+
+  glProgramBinary(handle, header.format, &binary[0], header.length);
+
+  GLint status = 0;
+  glGetProgramiv(handle, GL_LINK_STATUS, &status);
+  if( GL_FALSE == status ) {
+    // The driver rejected it, start over with a fresh program object
+    glDeleteProgram(handle);
+    handle = 0;
+    return false;
+  }
+
+  linked = true;
+  fromBinaryCache = true;
+  buildUniformTable();
+  return true;
+}
+
+void GLSLProgram::saveBinary( const string & path, GLuint64 key )
+{
+  GLint numFormats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+  if( numFormats == 0 ) return;
+
+  GLint length = 0;
+  glGetProgramiv(handle, GL_PROGRAM_BINARY_LENGTH, &length);
+  if( length <= 0 ) return;
+
+  GLSLBinaryCache::header header;
+  memcpy(header.magic, GLSLBinaryCache::MAGIC, 4);
+  header.version = GLSLBinaryCache::VERSION;
+  header.key = key;
+
+  std::vector<char> binary(length);
+  glGetProgramBinary(handle, length, &header.length, &header.format, &binary[0]);
+  if( header.length <= 0 ) return;
+
+  mkdir(binaryCacheDir.c_str(), 0755);
+
+  ofstream outFile( path.c_str(), ios::out | ios::binary | ios::trunc );
+  if( !outFile ) {
+    cerr << "Unable to write program binary: " << path << endl;
+    return;
+  }
+  outFile.write((const char *)&header, sizeof(header));
+  outFile.write(&binary[0], header.length);
+}
 
 void GLSLProgram::compileShader( const char * fileName )
   throw( GLSLProgramException ) {
@@ -122,6 +570,18 @@ throw( GLSLProgramException )
     }
   }
 
+  compileShader(readSource(fileName), type, fileName);
+}
+
+string GLSLProgram::readFile( const char * fileName )
+  throw( GLSLProgramException )
+{
+  if( ! fileExists(fileName) )
+  {
+    string message = string("Shader: ") + fileName + " not found.";
+    throw GLSLProgramException(message);
+  }
+
   ifstream inFile( fileName, ios::in );
   if( !inFile ) {
     string message = string("Unable to open: ") + fileName;
@@ -133,7 +593,36 @@ throw( GLSLProgramException )
   code << inFile.rdbuf();
   inFile.close();
 
-  compileShader(code.str(), type, fileName);
+  return code.str();
+}
+
+// The file with the definitions inserted after its #version line. A #line
+// directive keeps compiler messages pointing at the file's own lines.
+string GLSLProgram::readSource( const char * fileName )
+  throw( GLSLProgramException )
+{
+  string source = readFile(fileName);
+  if( defines.empty() )
+    return source;
+
+  size_t version = source.find("#version");
+  size_t insert = version == string::npos ? 0 : source.find('\n', version);
+  if( insert == string::npos )
+    insert = source.size();
+  else if( version != string::npos )
+    insert++;
+
+  int line = 1;
+  for( size_t i = 0; i < insert; i++ )
+    if( source[i] == '\n' ) line++;
+
+  return source.substr(0, insert) + defines.preamble() +
+         "#line " + std::to_string(line) + "\n" + source.substr(insert);
+}
+
+void GLSLProgram::setDefines( const GLSLDefines & defines )
+{
+  this->defines = defines;
 }
 
 void GLSLProgram::compileShader( const string & source,
@@ -214,13 +703,48 @@ void GLSLProgram::link() throw(GLSLProgramException)
 
     throw GLSLProgramException(string("Program link failed:\n") + logString);
   } else {
-    uniformLocations.clear();
     linked = true;
+    buildUniformTable();
+  }
+}
+
+// Fills the location table with every active uniform of the linked program,
+// so lookups never have to go back to the driver.
+void GLSLProgram::buildUniformTable()
+{
+  uniformLocations.clear();
+
+  GLint numUniforms = 0;
+  glGetProgramInterfaceiv( handle, GL_UNIFORM, GL_ACTIVE_RESOURCES, &numUniforms);
+
+  GLenum properties[] = {GL_NAME_LENGTH, GL_LOCATION, GL_BLOCK_INDEX};
+
+  for( int i = 0; i < numUniforms; ++i ) {
+    GLint results[3];
+    glGetProgramResourceiv(handle, GL_UNIFORM, i, 3, properties, 3, NULL, results);
+
+    if( results[2] != -1 ) continue;  // Uniforms in blocks have no location
+    GLint nameBufSize = results[0] + 1;
+    char * name = new char[nameBufSize];
+    glGetProgramResourceName(handle, GL_UNIFORM, i, nameBufSize, NULL, name);
+
+    string nameStr(name);
+    uniformLocations[nameStr] = results[1];
+
+    // Arrays are reported as "name[0]", make them reachable as "name" too
+    size_t len = nameStr.length();
+    if( len > 3 && nameStr.compare(len - 3, 3, "[0]") == 0 )
+      uniformLocations[nameStr.substr(0, len - 3)] = results[1];
+
+    delete [] name;
   }
 }
 
 void GLSLProgram::use() throw(GLSLProgramException)
 {
+  // First use of an asynchronously built program waits for it
+  resolve();
+
   if( handle <= 0 || (! linked) )
     throw GLSLProgramException("Shader has not been linked");
   glUseProgram( handle );
@@ -246,6 +770,22 @@ void GLSLProgram::bindFragDataLocation( GLuint location, const char * name )
   glBindFragDataLocation(handle, location, name);
 }
 
+void GLSLProgram::bindUniformBlock( const char * blockName, GLuint binding )
+{
+  // Still compiling, apply it once the link is done
+  if( pending ) {
+    pendingBlockBindings.push_back(std::make_pair(string(blockName), binding));
+    return;
+  }
+
+  GLuint blockIndex = glGetUniformBlockIndex(handle, blockName);
+
+  // Blocks the program doesn't use are optimized away, nothing to bind
+  if( blockIndex == GL_INVALID_INDEX ) return;
+
+  glUniformBlockBinding(handle, blockIndex, binding);
+}
+
 void GLSLProgram::setUniform( const char *name, float x, float y, float z)
 {
   GLint loc = getUniformLocation(name);
@@ -305,6 +845,87 @@ void GLSLProgram::setUniform( const char *name, bool val )
   glUniform1i(loc, val);
 }
 
+GLSLUniform GLSLProgram::getUniform( const char *name )
+{
+  resolve();
+  return GLSLUniform(getUniformLocation(name));
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, float x, float y, float z)
+{
+  glUniform3f(u.location,x,y,z);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, const vec2 & v)
+{
+  glUniform2f(u.location,v.x,v.y);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, const vec3 & v)
+{
+  glUniform3f(u.location,v.x,v.y,v.z);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, const vec4 & v)
+{
+  glUniform4f(u.location,v.x,v.y,v.z,v.w);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, const mat4 & m)
+{
+  glUniformMatrix4fv(u.location, 1, GL_FALSE, &m[0][0]);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, const mat3 & m)
+{
+  glUniformMatrix3fv(u.location, 1, GL_FALSE, &m[0][0]);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, float val )
+{
+  glUniform1f(u.location, val);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, int val )
+{
+  glUniform1i(u.location, val);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, bool val )
+{
+  glUniform1i(u.location, val);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, GLuint val )
+{
+  glUniform1ui(u.location, val);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, const vec3 * v, GLsizei count )
+{
+  glUniform3fv(u.location, count, &v[0].x);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, const vec4 * v, GLsizei count )
+{
+  glUniform4fv(u.location, count, &v[0].x);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, const mat4 * m, GLsizei count )
+{
+  glUniformMatrix4fv(u.location, count, GL_FALSE, &m[0][0][0]);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, const float * v, GLsizei count )
+{
+  glUniform1fv(u.location, count, v);
+}
+
+void GLSLProgram::setUniform( GLSLUniform u, const GLint * v, GLsizei count )
+{
+  glUniform1iv(u.location, count, v);
+}
+
 void GLSLProgram::printActiveUniforms() {
   GLint numUniforms = 0;
   glGetProgramInterfaceiv( handle, GL_UNIFORM, GL_ACTIVE_RESOURCES, &numUniforms);
@@ -446,11 +1067,14 @@ int GLSLProgram::getUniformLocation(const char * name )
   std::map<string, int>::iterator pos;
   pos = uniformLocations.find(name);
 
-  if( pos == uniformLocations.end() ) {
-    uniformLocations[name] = glGetUniformLocation(handle, name);
-  }
+  if( pos != uniformLocations.end() )
+    return pos->second;
 
-  return uniformLocations[name];
+  // Not in the table built at link time: an element past [0] of an array,
+  // or a uniform the compiler optimized away. Ask once and remember it.
+  GLint loc = glGetUniformLocation(handle, name);
+  uniformLocations.insert(std::make_pair(string(name), loc));
+  return loc;
 }
 
 bool GLSLProgram::fileExists( const string & fileName )
@@ -10,6 +10,8 @@
 #include <string>
 using std::string;
 #include <map>
+#include <vector>
+#include <functional>
 
 #include <glm/glm.hpp>
 using glm::vec2;
@@ -26,6 +28,38 @@ class GLSLProgramException : public std::runtime_error {
       std::runtime_error(msg) { }
 };
 
+// Handle to a uniform of a linked program. Obtained once with
+// GLSLProgram::getUniform and then passed to setUniform, so the per-frame
+// path does no name lookups. Stays valid until the program is relinked.
+struct GLSLUniform {
+    GLint location;
+
+    GLSLUniform() : location(-1) { }
+    explicit GLSLUniform( GLint location ) : location(location) { }
+
+    bool isActive() const { return location >= 0; }
+};
+
+// Preprocessor definitions that select one permutation of a shader. They
+// are inserted after the #version line of every stage, so counts and
+// switches become constants the compiler can unroll and fold. Kept sorted,
+// so the same set always gives the same key.
+class GLSLDefines
+{
+  private:
+    std::map<string, string> values;
+
+  public:
+    GLSLDefines & set( const string & name, int value );
+    GLSLDefines & set( const string & name, const string & value = string() );
+
+    bool   empty() const;
+    // "#define NAME VALUE" lines
+    string preamble() const;
+    // Identifies the permutation, e.g. "GAMMA=1;NUM_DIRS=0;"
+    string key() const;
+};
+
 namespace GLSLShader {
   enum GLSLShaderType {
     VERTEX = GL_VERTEX_SHADER,
@@ -42,11 +76,45 @@ class GLSLProgram
   private:
     int  handle;
     bool linked;
+    bool fromBinaryCache;
     std::map<string, int> uniformLocations;
-
+    GLSLDefines defines;
+
+    // State of a program submitted with initAsync and not yet checked
+    struct PendingShader {
+      GLuint handle;
+      string fileName;
+    };
+    bool pending;
+    std::vector<PendingShader> pendingShaders;
+    std::vector< std::pair<string, GLuint> > pendingBlockBindings;
+    string pendingCachePath;
+    GLuint64 pendingCacheKey;
+    std::function<void(GLSLProgram &)> readyCallback;
+
+    static string binaryCacheDir;
+    static int parallelCompile;
+
+    void   buildUniformTable();
     GLint  getUniformLocation(const char * name );
     bool fileExists( const string & fileName );
     string getExtension( const char * fileName );
+    string readFile( const char * fileName ) throw (GLSLProgramException);
+    string readSource( const char * fileName ) throw (GLSLProgramException);
+
+    string binaryCachePath( const char * vertexPath, const char * fragmentPath,
+        const char * geometryPath = NULL );
+    GLuint64 binaryCacheKey( const string & vertexSource, const string & fragmentSource,
+        const string & geometrySource = string() );
+    bool   loadBinary( const string & path, GLuint64 key );
+    void   saveBinary( const string & path, GLuint64 key );
+
+    void   submitShader( const string & source, GLSLShader::GLSLShaderType type,
+        const char * fileName );
+    void   finishAsync() throw (GLSLProgramException);
+    void   resolve();
+    void   runReady();
+    static bool hasParallelCompile();
 
     // Make these private in order to make the object non-copyable
     GLSLProgram( const GLSLProgram & other ) { }
@@ -54,10 +122,43 @@ class GLSLProgram
 
   public:
     GLSLProgram();
-    ~GLSLProgram();
-
+    ~GLSLProgram();
+
+    // Compiles and links a vertex/fragment program; call validate() once
+    // its sampler units are set. The linked binary is kept in the binary
+    // cache directory and reused on the next start as long as the sources
+    // and the driver are unchanged.
     void   init(const GLchar* vertexPath, const GLchar* fragmentPath);
 
+    // Same as init, but only submits the compile and link to the driver.
+    // Status is checked the first time the program is used, or when
+    // isReady() sees that the driver has finished, so several programs can
+    // compile in parallel (GL_KHR_parallel_shader_compile). Errors are
+    // reported like init's.
+    void   initAsync(const GLchar* vertexPath, const GLchar* fragmentPath);
+    // With a geometry stage between the two
+    void   initAsync(const GLchar* vertexPath, const GLchar* geometryPath,
+                     const GLchar* fragmentPath);
+    // A compute-only program
+    void   initComputeAsync(const GLchar* computePath);
+
+    // Non-blocking when the driver supports parallel compilation, otherwise
+    // waits for the link. Runs the onReady callback the first time the
+    // program becomes usable, then validates it with the units the
+    // callback set.
+    bool   isReady();
+    // Blocks until the program is built, then as isReady
+    void   wait();
+    void   onReady( std::function<void(GLSLProgram &)> callback );
+
+    // Definitions for the next init, initAsync or compileShader call. Each
+    // permutation gets its own binary cache entry.
+    void   setDefines( const GLSLDefines & defines );
+
+    // Directory for cached program binaries, empty disables the cache
+    static void setBinaryCacheDir( const string & dir );
+    bool   isFromBinaryCache();
+
     void   compileShader( const char *fileName ) throw (GLSLProgramException);
     void   compileShader( const char * fileName, GLSLShader::GLSLShaderType type ) throw (GLSLProgramException);
     void   compileShader( const string & source, GLSLShader::GLSLShaderType type,
@@ -72,6 +173,7 @@ class GLSLProgram
 
     void   bindAttribLocation( GLuint location, const char * name);
     void   bindFragDataLocation( GLuint location, const char * name );
+    void   bindUniformBlock( const char * blockName, GLuint binding );
 
     void   setUniform( const char *name, float x, float y, float z);
     void   setUniform( const char *name, const vec2 & v);
@@ -84,6 +186,24 @@ class GLSLProgram
     void   setUniform( const char *name, bool val );
     void   setUniform( const char *name, GLuint val );
 
+    GLSLUniform getUniform( const char *name );
+
+    void   setUniform( GLSLUniform u, float x, float y, float z);
+    void   setUniform( GLSLUniform u, const vec2 & v);
+    void   setUniform( GLSLUniform u, const vec3 & v);
+    void   setUniform( GLSLUniform u, const vec4 & v);
+    void   setUniform( GLSLUniform u, const mat4 & m);
+    void   setUniform( GLSLUniform u, const mat3 & m);
+    void   setUniform( GLSLUniform u, float val );
+    void   setUniform( GLSLUniform u, int val );
+    void   setUniform( GLSLUniform u, bool val );
+    void   setUniform( GLSLUniform u, GLuint val );
+    void   setUniform( GLSLUniform u, const vec3 * v, GLsizei count );
+    void   setUniform( GLSLUniform u, const vec4 * v, GLsizei count );
+    void   setUniform( GLSLUniform u, const mat4 * m, GLsizei count );
+    void   setUniform( GLSLUniform u, const float * v, GLsizei count );
+    void   setUniform( GLSLUniform u, const GLint * v, GLsizei count );
+
     void   printActiveUniforms();
     void   printActiveUniformBlocks();
     void   printActiveAttribs();
@@ -6,6 +6,13 @@
 #include <string>
 using std::string;
 
+#if defined(_WIN32)
+#include <windows.h>
+#elif !defined(__APPLE__)
+// Same entry point gl_core_4_3.c loads through, without the X11 headers
+extern "C" void (*glXGetProcAddressARB(const GLubyte * procName))(void);
+#endif
+
 namespace GLUtils {
 
 void APIENTRY debugCallback( GLenum source, GLenum type, GLuint id,
@@ -157,4 +164,14 @@ void dumpGLInfo(bool dumpExtensions) {
     }
 }
 
+void * getProcAddress(const char * name) {
+#if defined(_WIN32)
+    return (void *)wglGetProcAddress(name);
+#elif defined(__APPLE__)
+    return NULL;
+#else
+    return (void *)glXGetProcAddressARB((const GLubyte *)name);
+#endif
+}
+
 } // namespace GLUtils
@@ -8,6 +8,9 @@ namespace GLUtils
     int checkForOpenGLError(const char *, int);
     
     void dumpGLInfo(bool dumpExtensions = false);
+
+    // For extension entry points the generated loader doesn't cover
+    void * getProcAddress(const char * name);
     
     void APIENTRY debugCallback( GLenum source, GLenum type, GLuint id,
 		GLenum severity, GLsizei length, const GLchar * msg, const void * param );
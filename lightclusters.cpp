@@ -0,0 +1,145 @@
+#include "lightclusters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+namespace {
+  // std430 headers in front of the arrays
+  struct LightsHeader {
+    GLuint numLights;
+    GLuint padding[3];
+  };
+
+  struct GridHeader {
+    GLuint clusterCount[4];   // x, y, z, w indices per froxel
+    GLfloat clusterScale[4];  // xy froxels per pixel, z slice scale, w slice bias
+  };
+}
+
+LightClusters::LightClusters() : lightBuffer(0), gridBuffer(0), indexBuffer(0),
+    lightCapacity(0), indicesPerCluster(0), numLights(0), nearPlane(0.1f), farPlane(100.0f)
+{
+}
+
+LightClusters::~LightClusters()
+{
+    GLuint buffers[] = { lightBuffer, gridBuffer, indexBuffer };
+    for( int i = 0; i < 3; ++i )
+        if( buffers[i] != 0 )
+            glDeleteBuffers(1, &buffers[i]);
+}
+
+void LightClusters::create( GLsizei screenWidth, GLsizei screenHeight, float nearPlane,
+                            float farPlane )
+{
+    this->nearPlane = nearPlane;
+    this->farPlane = farPlane;
+
+    const GLuint numClusters = GRID_X * GRID_Y * GRID_Z;
+
+    // slice = log(depth) * scale + bias puts near at 0 and far at GRID_Z
+    float logRatio = logf(farPlane / nearPlane);
+    GridHeader header = {
+        { GRID_X, GRID_Y, GRID_Z, 0 },
+        { (float)GRID_X / screenWidth, (float)GRID_Y / screenHeight,
+          GRID_Z / logRatio, -GRID_Z * logf(nearPlane) / logRatio }
+    };
+
+    if( gridBuffer == 0 )
+        glGenBuffers(1, &gridBuffer);
+    // Every froxel starts empty, until the first cull runs
+    std::vector<GLuint> empty(numClusters * 2, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GridHeader) + numClusters * 2 * sizeof(GLuint),
+                 NULL, GL_DYNAMIC_COPY);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GridHeader), numClusters * 2 * sizeof(GLuint),
+                    &empty[0]);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GridHeader), &header);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LightClusterBinding::GRID, gridBuffer);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Sizes the froxel slices, and writes their size to the header
+    indicesPerCluster = 0;
+    setLights(NULL, 0);
+}
+
+void LightClusters::setLights( const PointLightData * lights, GLsizei count )
+{
+    numLights = count;
+
+    if( lightBuffer == 0 )
+        glGenBuffers(1, &lightBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+    if( count > lightCapacity || lightCapacity == 0 ) {
+        lightCapacity = count > 0 ? count : 1;
+        glBufferData(GL_SHADER_STORAGE_BUFFER,
+                     sizeof(LightsHeader) + lightCapacity * sizeof(PointLightData),
+                     NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LightClusterBinding::LIGHTS, lightBuffer);
+    }
+
+    LightsHeader header = { (GLuint)count, { 0, 0, 0 } };
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(LightsHeader), &header);
+    if( count > 0 )
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(LightsHeader),
+                        count * sizeof(PointLightData), lights);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if( count > (GLsizei)MAX_CLUSTER_LIGHTS )
+        std::cerr << "Froxels reached by more than " << MAX_CLUSTER_LIGHTS << " of the "
+                  << count << " point lights leave the rest out" << std::endl;
+
+    // A froxel's slice only ever grows, so its offset stays cluster * size
+    GLuint needed = std::min(std::max((GLuint)count, (GLuint)1), MAX_CLUSTER_LIGHTS);
+    if( needed <= indicesPerCluster || gridBuffer == 0 )
+        return;
+    indicesPerCluster = needed;
+
+    const GLuint numClusters = GRID_X * GRID_Y * GRID_Z;
+    if( indexBuffer == 0 )
+        glGenBuffers(1, &indexBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, numClusters * indicesPerCluster * sizeof(GLuint),
+                 NULL, GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LightClusterBinding::INDICES, indexBuffer);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(GridHeader, clusterCount) + 3 * sizeof(GLuint),
+                    sizeof(GLuint), &indicesPerCluster);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void LightClusters::cull()
+{
+    const GLuint numClusters = GRID_X * GRID_Y * GRID_Z;
+    glDispatchCompute((numClusters + LOCAL_SIZE - 1) / LOCAL_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+GLsizei LightClusters::getNumLights()
+{
+    return numLights;
+}
+
+float LightClusters::getNearPlane()
+{
+    return nearPlane;
+}
+
+float LightClusters::getFarPlane()
+{
+    return farPlane;
+}
+
+float LightClusters::lightRange( float constant, float linear, float quadratic, float cutoff )
+{
+    // Solve constant + linear * d + quadratic * d^2 = 1 / cutoff
+    float c = constant - 1.0f / cutoff;
+    if( quadratic <= 0.0f )
+        return linear > 0.0f ? -c / linear : 0.0f;
+    return (-linear + sqrtf(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic);
+}
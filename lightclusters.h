@@ -0,0 +1,82 @@
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include "cookbookogl.h"
+
+#include <glm/glm.hpp>
+using glm::vec4;
+
+// Shader storage binding points of the clustered lighting buffers. The
+// GLSL blocks name them explicitly; 0 is the diamonds' material table.
+namespace LightClusterBinding {
+  enum Binding {
+    LIGHTS = 1,
+    GRID = 2,
+    INDICES = 3
+  };
+};
+
+// One point light as the shaders see it (std430). The colours and
+// attenuation come from the shared PointLight in the Lights block.
+struct PointLightData
+{
+    vec4 position;      // xyz world position, w range
+    vec4 color;         // rgb scale of the shared colours, w unused
+};
+
+// Clustered forward lighting. The view frustum is split into a grid of
+// froxels, GRID_X by GRID_Y tiles on screen and GRID_Z slices spaced
+// exponentially in depth. A compute pass bins the point lights into the
+// froxels each frame and writes one index list per froxel, so a fragment
+// only shades the lights whose range reaches its froxel. Each froxel has a
+// fixed slice of the index buffer, as long as the most lights it can hold.
+class LightClusters
+{
+  public:
+    static const GLuint GRID_X = 16;
+    static const GLuint GRID_Y = 9;
+    static const GLuint GRID_Z = 24;
+    static const GLuint LOCAL_SIZE = 128;   // Matches LightClusters.comp
+    static const GLuint MAX_CLUSTER_LIGHTS = 128;   // Matches LightClusters.comp
+
+  private:
+    GLuint lightBuffer;
+    GLuint gridBuffer;
+    GLuint indexBuffer;
+    GLsizei lightCapacity;
+    GLuint indicesPerCluster;
+    GLsizei numLights;
+    float nearPlane;
+    float farPlane;
+
+    // Non-copyable
+    LightClusters( const LightClusters & other ) { }
+    LightClusters & operator=( const LightClusters &other ) { return *this; }
+
+  public:
+    LightClusters();
+    ~LightClusters();
+
+    // The grid covers a screenWidth by screenHeight target drawn with a
+    // projection from nearPlane to farPlane.
+    void   create( GLsizei screenWidth, GLsizei screenHeight, float nearPlane,
+                   float farPlane );
+
+    // Grows the froxel slices to fit count lights, up to MAX_CLUSTER_LIGHTS.
+    // Past that a froxel keeps the lowest numbered lights reaching it.
+    void   setLights( const PointLightData * lights, GLsizei count );
+
+    // Runs the binning with the culling program, which the caller has in
+    // use with its per-frame uniforms set, and makes the lists visible to
+    // the draws that follow.
+    void   cull();
+
+    GLsizei getNumLights();
+    float  getNearPlane();
+    float  getFarPlane();
+
+    // Distance at which attenuation drops to cutoff
+    static float lightRange( float constant, float linear, float quadratic, float cutoff );
+};
+
+#endif // LIGHTCLUSTERS_H
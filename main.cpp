@@ -1,7 +1,13 @@
 // Std. Includes
 #include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <chrono>
 
 #include "gl_core_4_3.h"
 
@@ -24,6 +30,17 @@
 #include "vbotorus.h"
 #include "vboplane.h"
 #include "Standard_Materials.h"
+#include "uniformbuffer.h"
+#include "vertexpacking.h"
+#include "textureloader.h"
+#include "benchmark.h"
+#include "offscreencontext.h"
+#include "cascadedshadowmap.h"
+#include "pointshadowmap.h"
+#include "lightclusters.h"
+#include "gbuffer.h"
+#include "materiallibrary.h"
+#include "renderqueue.h"
 
 // Other Libs
 #include <SOIL.h>
@@ -43,6 +60,8 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos);
 void doMovement();
 GLuint loadTexture(GLchar* path, bool sRGB = false);
 void RenderQuad();
+void beginPass(const char *name);
+void endPass();
 
 // Camera
 Camera camera(glm::vec3(0.0f, 0.0f, 4.0f));
@@ -61,25 +80,117 @@ glm::vec3 tungsten100W(1.0f, 0.850980392f, 0.666666667f);
 // Light source
 glm::vec3 lightPos(0.0f, 5.0f, 0.0f);
 
+// std140 mirrors of the shared uniform blocks in shaders/
+struct CameraBlock
+{
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec4 viewPos;
+};
+
+struct LightsBlock
+{
+    // struct PointLight
+    GLfloat constant;
+    GLfloat linear;
+    GLfloat quadratic;
+    GLfloat padding0;
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+};
+
+// Headless benchmark mode, null when running interactively
+Benchmark *benchmark = nullptr;
+
 
-int main()
+int main(int argc, char *argv[])
 {
+    // Command line: --benchmark <frames> runs headless and writes a timing
+    // report to --report <path> (bench_report.json by default).
+    // --hardware keeps the system GL driver instead of forcing llvmpipe.
+    // --instances <n> replaces the 24 hand-placed diamonds with an n-object grid.
+    // --packed-vertices uploads meshes in the 16 byte PackedVertex layout.
+    // --uncompressed-textures keeps textures as RGB8 instead of BC1.
+    // --sdf-text draws text from a signed distance field atlas.
+    // --shadow-cache draws static shadow casters once into a cached layer.
+    // --point-shadow-budget <n> redraws at most n lamp shadows a frame (2).
+    // --lights <n> adds n small coloured lights over the floor.
+    // --deferred shades the floor, walls and diamonds from a G-buffer.
+    // --pcf-radius <n> filters cascade shadows over (2n+1)^2 texels (1).
+    int benchmarkFrames = 0;
+    int numDiamonds = 24;
+    const char *reportPath = "bench_report.json";
+    bool softwareGL = true;
+    bool compressTextures = true;
+    bool sdfText = false;
+    bool cacheShadows = false;
+    int pointShadowBudget = 2;
+    int extraLights = 0;
+    bool deferred = false;
+    int pcfRadius = 1;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+            benchmarkFrames = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--report") == 0 && i + 1 < argc)
+            reportPath = argv[++i];
+        else if(strcmp(argv[i], "--hardware") == 0)
+            softwareGL = false;
+        else if(strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+            numDiamonds = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--packed-vertices") == 0)
+            VertexPacking::setEnabled(true);
+        else if(strcmp(argv[i], "--uncompressed-textures") == 0)
+            compressTextures = false;
+        else if(strcmp(argv[i], "--sdf-text") == 0)
+            sdfText = true;
+        else if(strcmp(argv[i], "--shadow-cache") == 0)
+            cacheShadows = true;
+        else if(strcmp(argv[i], "--point-shadow-budget") == 0 && i + 1 < argc)
+            pointShadowBudget = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+            extraLights = max(0, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--deferred") == 0)
+            deferred = true;
+        else if(strcmp(argv[i], "--pcf-radius") == 0 && i + 1 < argc)
+            pcfRadius = max(0, atoi(argv[++i]));
+    }
+
+    bool headless = benchmarkFrames > 0;
 
     loadStdMats();
     stdMaterial matDefinition;
 
-    // Init GLFW
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_RESIZABLE, 0);
-    glfwWindowHint(GLFW_SAMPLES, 4);
-    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+    GLFWwindow* window = nullptr;
+    OffscreenContext offscreen;
 
-    GLFWwindow* window = glfwCreateWindow(screenWidth, screenHeight,
-                                          "LearnOpenGL", nullptr, nullptr);
-    glfwMakeContextCurrent(window);
+    if(headless)
+    {
+        try {
+            offscreen.create(screenWidth, screenHeight, softwareGL);
+        }
+        catch(OffscreenContextException &e) {
+            cerr << e.what() << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        // Init GLFW
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_RESIZABLE, 0);
+        glfwWindowHint(GLFW_SAMPLES, 4);
+        glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+
+        window = glfwCreateWindow(screenWidth, screenHeight, "LearnOpenGL",
+                                  nullptr, nullptr);
+        glfwMakeContextCurrent(window);
+    }
 
     int loaded = ogl_LoadFunctions();
     if(loaded == ogl_LOAD_FAILED) {
@@ -88,14 +199,33 @@ int main()
     int num_failed = loaded - ogl_LOAD_SUCCEEDED;
     printf("Number of functions that failed to load: %i.\n",num_failed);
 
+    // Everything that would go to the default framebuffer goes here instead
+    GLuint sceneFBO = 0;
+
+    if(headless)
+    {
+        try {
+            offscreen.createFramebuffer();
+        }
+        catch(OffscreenContextException &e) {
+            cerr << e.what() << endl;
+            return EXIT_FAILURE;
+        }
+        sceneFBO = offscreen.getFramebuffer();
+        benchmark = new Benchmark(benchmarkFrames);
+    }
+    else
+    {
+        // Set the required callback functions
+        glfwSetKeyCallback(window, keyCallback);
+        glfwSetCursorPosCallback(window, mouseCallback);
+        glfwSetScrollCallback(window, scrollCallback);
 
-    // Set the required callback functions
-    glfwSetKeyCallback(window, keyCallback);
-    glfwSetCursorPosCallback(window, mouseCallback);
-    glfwSetScrollCallback(window, scrollCallback);
+        // Options
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    }
 
-    // Options
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
 
     // Define the viewport dimensions
     glViewport(0, 0, screenWidth, screenHeight);
@@ -115,41 +245,119 @@ int main()
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
     GLSLProgram lampShader, floorShader, wallShader, textShader, diamondShader,
-                depthShader, debugDepthQuad;
+                depthShader, depthInstancedShader, pointDepthShader,
+                pointDepthInstancedShader, clusterShader, gBufferTexShader,
+                gBufferInstancedShader, lightingShader, debugDepthQuad;
+
+    chrono::steady_clock::time_point shaderStart = chrono::steady_clock::now();
+
+    // Light counts and switches that are fixed for a program are compiled in
+    // as defines, each combination being its own cached binary
+    GLSLDefines shadowedDefines;
+    shadowedDefines.set("SHADOWS", 1)
+                   .set("NUM_CASCADES", CascadedShadowMap::MAX_CASCADES)
+                   .set("PCF_RADIUS", pcfRadius);
+
+    lampShader.initAsync("shaders/lamp.vert","shaders/lamp.frag");
+    textShader.initAsync("shaders/text.vert", sdfText ? "shaders/text_sdf.frag" : "shaders/text.frag");
+    if(deferred)
+    {
+        gBufferTexShader.initAsync("shaders/MultiLightTex.vert","shaders/GBufferTex.frag");
+        gBufferInstancedShader.initAsync("shaders/MultiLightInstanced.vert",
+                                         "shaders/GBufferInstanced.frag");
+        lightingShader.setDefines(GLSLDefines(shadowedDefines).set("GAMMA", 1));
+        lightingShader.initAsync("shaders/DeferredLighting.vert","shaders/DeferredLighting.frag");
+    }
+    else
+    {
+        floorShader.setDefines(GLSLDefines(shadowedDefines).set("GAMMA", 1));
+        floorShader.initAsync("shaders/MultiLightTex.vert","shaders/MultiLightTex.frag");
+        wallShader.setDefines(GLSLDefines().set("GAMMA", 1));
+        wallShader.initAsync("shaders/MultiLightTex.vert","shaders/MultiLightTex.frag");
+        diamondShader.setDefines(GLSLDefines().set("NUM_DIRS", 1));
+        diamondShader.initAsync("shaders/MultiLightInstanced.vert","shaders/MultiLightInstanced.frag");
+    }
+    depthShader.initAsync("shaders/SimpleDepth.vert","shaders/SimpleDepth.frag");
+    depthInstancedShader.initAsync("shaders/SimpleDepthInstanced.vert","shaders/SimpleDepth.frag");
+    pointDepthShader.initAsync("shaders/SimpleDepth.vert","shaders/PointShadowDepth.geom",
+                               "shaders/PointShadowDepth.frag");
+    pointDepthInstancedShader.initAsync("shaders/SimpleDepthInstanced.vert",
+                                        "shaders/PointShadowDepth.geom",
+                                        "shaders/PointShadowDepth.frag");
+    clusterShader.initComputeAsync("shaders/LightClusters.comp");
+    debugDepthQuad.initAsync("shaders/depthMap.vert","shaders/depthMap.frag");
+
+    // Only the programs of the chosen shading path are built
+    vector<GLSLProgram *> allPrograms = {&lampShader, &textShader, &depthShader,
+                                         &depthInstancedShader, &pointDepthShader,
+                                         &pointDepthInstancedShader, &clusterShader,
+                                         &debugDepthQuad};
+    vector<GLSLProgram *> litPrograms;
+    if(deferred)
+        litPrograms = {&gBufferTexShader, &gBufferInstancedShader, &lightingShader};
+    else
+        litPrograms = {&floorShader, &wallShader, &diamondShader};
+    allPrograms.insert(allPrograms.end(), litPrograms.begin(), litPrograms.end());
+
+    int cachedPrograms = 0;
+    for(GLSLProgram *program : allPrograms)
+        cachedPrograms += program->isFromBinaryCache() ? 1 : 0;
+
+    const int numPrograms = (int)allPrograms.size();
+
+    // Compiles carry on in the driver while the meshes and textures load;
+    // each program's one-off setup runs from its onReady callback
+    chrono::duration<double, milli> shaderTime = chrono::steady_clock::now() - shaderStart;
+    printf("Shader programs submitted in %.1f ms (%d of %d from the binary cache).\n",
+           shaderTime.count(), cachedPrograms, numPrograms);
+    bool allProgramsReady = false;
+
+    // Model and scene textures are decoded on worker threads while the rest loads
+    TextureLoader textureLoader;
+    textureLoader.setCompression(compressTextures);
+    TextureLoader::setShared(&textureLoader);
+    chrono::steady_clock::time_point textureStart = chrono::steady_clock::now();
+    bool allTexturesReady = false;
+
+    GLuint floorTexture = loadTexture((char *)"textures/wood2.png", true);
+    GLuint floorSpec = loadTexture((char *)"textures/wood_spec.png");
+    GLuint wallTexture = loadTexture((char *)"textures/stucco.png", true);
+    GLuint wallSpec = loadTexture((char *)"textures/stucco_spec.png");
+
+    // Surface flags of the G-buffer, matching DeferredLighting.frag
+    const GLint SURFACE_SHADOWED = 1;
+    const GLint SURFACE_DIR_LIT = 2;
+
+    // The textures move into array pages as they arrive, so the floor and
+    // walls only differ by a material index
+    MaterialLibrary materials(&textureLoader);
+    GLuint floorMaterial = materials.add(floorTexture, floorSpec, 128.0f, 1.0f, 1.0f,
+                                         SURFACE_SHADOWED);
+    // The stucco picks up less of the lamps than the floor and diamonds do
+    GLuint wallMaterial = materials.add(wallTexture, wallSpec, 1.0f, 0.3f / 0.7f, 0.5f / 2.0f);
 
-    lampShader.init("shaders/lamp.vert","shaders/lamp.frag");
-    floorShader.init("shaders/MultiLightTexShadow.vert","shaders/MultiLightTexShadow.frag");
-    wallShader.init("shaders/MultiLightTex.vert","shaders/MultiLightTex.frag");
-    textShader.init("shaders/text.vert","shaders/text.frag");
-    diamondShader.init("shaders/MultiLight.vert","shaders/MultiLight.frag");
-    depthShader.init("shaders/SimpleDepth.vert","shaders/SimpleDepth.frag");
-    debugDepthQuad.init("shaders/depthMap.vert","shaders/depthMap.frag");
+    GLint materialUnits[MaterialLibrary::MAX_PAGES];
+    for(int i = 0; i < MaterialLibrary::MAX_PAGES; ++i)
+        materialUnits[i] = MaterialLibrary::FIRST_UNIT + i;
 
     VBOCube cube;
     VBOTorus torus(0.7f, 0.3f, 60, 60);
     VBOPlane floor(15.0f, 15.0f, 1, 1, 6.0f, 6.0f);
     VBOPlane wall(15.0f, 6.0f, 1, 1, 8.0f, 8.0f);
 
-    GLuint depthMapFBO;
-    glGenFramebuffers(1, &depthMapFBO);
+    // Shadows of the overhead light, spread over cascades that follow the
+    // camera out to SHADOW_DISTANCE
+    const GLsizei SHADOW_RESOLUTION = 1024;
+    const GLfloat SHADOW_DISTANCE = 30.0f;
 
-    const GLuint SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
+    CascadedShadowMap shadowMap;
+    shadowMap.create(CascadedShadowMap::MAX_CASCADES, SHADOW_RESOLUTION);
+    shadowMap.setStaticCaching(cacheShadows);
 
-    GLuint depthMap;
-    glGenTextures(1, &depthMap);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-    SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // Bounding spheres for culling casters per cascade
+    const glm::vec3 floorCenter(0.0f, -1.0f, 0.0f);
+    const GLfloat floorRadius = 7.5f * sqrt(2.0f);
+    const GLfloat diamondRadius = 0.5f;
 
 
     Model diamond("models/diamond.obj");
@@ -163,6 +371,15 @@ int main()
         glm::vec3( 3.5f,  4.9f,  4.0f)
     };
 
+    // Shadows of the six lamps, a few of them redrawn each frame
+    const GLsizei POINT_SHADOW_RESOLUTION = 256;
+
+    PointShadowMap pointShadows;
+    pointShadows.create(6, POINT_SHADOW_RESOLUTION);
+    pointShadows.setUpdateBudget(pointShadowBudget);
+    for(int i = 0; i < 6; ++i)
+        pointShadows.setLightPosition(i, pointLightPos[i]);
+
     glm::vec3 *matObjPositions = new glm::vec3[24] {
         glm::vec3(-5.5f,  0.0f, -6.0f),
         glm::vec3(-3.5f,  0.0f, -6.0f),
@@ -217,82 +434,264 @@ int main()
         "yellow rubber"
     };
 
-    // Variables for the Frame Rate Display
-    GLint frameRateCounterTarget = 4;
-    GLint frameRateCounter = frameRateCounterTarget;
-    string frameRateString;
-
-    Text frameRateText(textShader, "fonts/Arial.ttf", 48, screenWidth,
-                       screenHeight);
-
-    // Load textures
-    GLuint floorTexture = loadTexture((char *)"textures/wood2.png", true);
-    GLuint floorSpec = loadTexture((char *)"textures/wood_spec.png");
-    GLuint wallTexture = loadTexture((char *)"textures/stucco.png", true);
-    GLuint wallSpec = loadTexture((char *)"textures/stucco_spec.png");
-
-    // Set texture units
-    floorShader.use();
+    // Per-instance transforms and material indices for the diamonds. The
+    // default 24 use the hand-placed positions, larger counts are laid out
+    // on a square grid two units apart.
+    vector<InstanceData> diamondInstances(numDiamonds);
+    GLint gridSide = (GLint)ceil(sqrt((float)numDiamonds));
 
-    floorShader.setUniform("gamma", true);
-    floorShader.setUniform("material.diffuse", 0);
-    floorShader.setUniform("material.specular", 1);
-    floorShader.setUniform("shadowMap", 3);
-    floorShader.setUniform("lightPos", lightPos);
+    for(GLint i = 0; i < numDiamonds; ++i)
+    {
+        glm::vec3 position;
+        if(numDiamonds == 24)
+            position = matObjPositions[i];
+        else
+            position = glm::vec3(2.0f * (i % gridSide - (gridSide - 1) * 0.5f), 0.0f,
+                                 2.0f * (i / gridSide - (gridSide - 1) * 0.5f));
+
+        diamondInstances[i].Model = glm::translate(position);
+        diamondInstances[i].Material = i % 24;
+    }
 
-    floorShader.setUniform("numPoints", 6);
-    floorShader.setUniform("pointLight.constant", 1.0f);
-    floorShader.setUniform("pointLight.linear", 0.09f);
-    floorShader.setUniform("pointLight.quadratic", 0.032f);
+    diamond.setInstances(diamondInstances);
 
-    floorShader.setUniform("pointLight.ambient", glm::vec3(0.08f) * halogen);
-    floorShader.setUniform("pointLight.diffuse", glm::vec3(0.7f) * halogen);
-    floorShader.setUniform("pointLight.specular", glm::vec3(2.0f) * halogen);
+    // Diamonds inside each shadow cascade, stored in the instance buffer
+    // after the full set and uploaded again only when they change
+    vector<GLint> shadowInstanceIds, previousShadowInstanceIds;
+    vector<InstanceData> shadowInstances;
+    GLsizei cascadeFirst[CascadedShadowMap::MAX_CASCADES];
+    GLsizei cascadeCount[CascadedShadowMap::MAX_CASCADES];
 
-    floorShader.setUniform("material.shininess", 128.0f);
-    glUniform3fv(glGetUniformLocation(floorShader.getHandle(), "pointLightPos")
-                 , 6, glm::value_ptr(pointLightPos[0]));
+    // Material table indexed by the instances, bound as shader storage block 0
+    stdMaterialBlock diamondMaterials[24];
+    for(GLint i = 0; i < 24; ++i)
+        diamondMaterials[i] = toMaterialBlock(stdMatMap[matList[i]]);
 
+    GLuint materialSSBO;
+    glGenBuffers(1, &materialSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(diamondMaterials),
+                 diamondMaterials, GL_STATIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, materialSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-    wallShader.use();
+    // Variables for the Frame Rate Display
+    GLint frameRateCounterTarget = 4;
+    GLint frameRateCounter = frameRateCounterTarget;
+    string frameRateString;
 
-    wallShader.setUniform("gamma", true);
-    wallShader.setUniform("material.diffuse", 0);
-    wallShader.setUniform("material.specular", 1);
+    Text frameRateText(textShader, "fonts/Arial.ttf", 48, screenWidth,
+                       screenHeight, sdfText ? TEXT_SDF : TEXT_BITMAP);
+    frameRateText.preload("0123456789.");
+    // Shaped again only when the frame rate string changes
+    TextLayout frameRateLabel(frameRateText, 0.5f);
+
+    // Shared uniform blocks: the camera is updated once per frame, the
+    // ceiling lamps only once here
+    vector<GLSLProgram *> blockPrograms = litPrograms;
+    blockPrograms.push_back(&lampShader);
+    for(GLSLProgram *program : blockPrograms)
+    {
+        program->bindUniformBlock("Camera", UniformBlock::CAMERA);
+        program->bindUniformBlock("Lights", UniformBlock::LIGHTS);
+    }
 
-    wallShader.setUniform("numPoints", 6);
-    wallShader.setUniform("pointLight.constant", 1.0f);
-    wallShader.setUniform("pointLight.linear", 0.09f);
-    wallShader.setUniform("pointLight.quadratic", 0.032f);
+    CameraBlock cameraBlock;
+    UniformBuffer cameraUBO;
+    cameraUBO.create(sizeof(CameraBlock), UniformBlock::CAMERA);
+
+    LightsBlock lightsBlock = {};
+    lightsBlock.constant = 1.0f;
+    lightsBlock.linear = 0.09f;
+    lightsBlock.quadratic = 0.032f;
+    lightsBlock.ambient = glm::vec4(glm::vec3(0.08f) * halogen, 0.0f);
+    lightsBlock.diffuse = glm::vec4(glm::vec3(0.7f) * halogen, 0.0f);
+    lightsBlock.specular = glm::vec4(glm::vec3(2.0f) * halogen, 0.0f);
+
+    UniformBuffer lightsUBO;
+    lightsUBO.create(sizeof(LightsBlock), UniformBlock::LIGHTS, &lightsBlock);
+
+    // Point lights are shaded per froxel. The lamps reach the whole room;
+    // their range is where they fall below one 8-bit step.
+    LightClusters lightClusters;
+    lightClusters.create(screenWidth, screenHeight, 0.1f, 100.0f);
+
+    GLfloat lampRange = LightClusters::lightRange(lightsBlock.constant, lightsBlock.linear,
+                                                  lightsBlock.quadratic, 1.0f / 256.0f);
+    vector<PointLightData> pointLights;
+    for(GLint i = 0; i < 6; ++i)
+    {
+        PointLightData light = { glm::vec4(pointLightPos[i], lampRange), glm::vec4(1.0f) };
+        pointLights.push_back(light);
+    }
+    // The lamps come first, their indices match the point shadows
+    GLint extraSide = (GLint)ceil(sqrt((float)extraLights));
+    for(GLint i = 0; i < extraLights; ++i)
+    {
+        GLfloat x = ((i % extraSide) + 0.5f) / extraSide * 14.0f - 7.0f;
+        GLfloat z = ((i / extraSide) + 0.5f) / extraSide * 14.0f - 7.0f;
+        glm::vec3 hue(0.5f + 0.5f * sin(i * 1.3f), 0.5f + 0.5f * sin(i * 2.1f + 2.0f),
+                      0.5f + 0.5f * sin(i * 2.9f + 4.0f));
+        PointLightData light = { glm::vec4(x, -0.7f, z, 1.5f), glm::vec4(hue * 0.1f, 0.0f) };
+        pointLights.push_back(light);
+    }
+    lightClusters.setLights(pointLights.data(), (GLsizei)pointLights.size());
 
-    wallShader.setUniform("pointLight.ambient", glm::vec3(0.08f) * halogen);
-    wallShader.setUniform("pointLight.diffuse", glm::vec3(0.3f) * halogen);
-    wallShader.setUniform("pointLight.specular", glm::vec3(0.5f) * halogen);
+    // The deferred path lights once per pixel from a G-buffer with a
+    // full screen triangle, which needs a VAO but no buffers
+    GBuffer gBuffer;
+    GLuint fullscreenVAO = 0;
+    if(deferred)
+    {
+        gBuffer.create(screenWidth, screenHeight);
+        glGenVertexArrays(1, &fullscreenVAO);
+    }
 
-    wallShader.setUniform("material.shininess", 1.0f);
-    glUniform3fv(glGetUniformLocation(wallShader.getHandle(), "pointLightPos")
-                 , 6, glm::value_ptr(pointLightPos[0]));
+    // Uniform handles set every frame, resolved once so the loop does no name lookups
+    GLSLUniform depthLightSpaceUniform, depthModelUniform;
+    GLSLUniform depthInstancedLightSpaceUniform, depthInstancedModelUniform;
+    GLSLUniform pointDepthLightsUniform, pointDepthNumLightsUniform, pointDepthModelUniform;
+    GLSLUniform pointDepthInstancedLightsUniform, pointDepthInstancedNumLightsUniform;
+    GLSLUniform pointDepthInstancedModelUniform;
+    GLSLUniform clusterInverseProjectionUniform, clusterViewUniform;
+    GLSLUniform lampModelUniform;
+    GLSLUniform floorModelUniform, floorLightSpaceUniform, floorCascadeSplitsUniform;
+    GLSLUniform floorCascadeBiasUniform, floorShadowLightDirUniform;
+    GLSLUniform wallModelUniform;
+    GLSLUniform diamondModelUniform;
+    GLSLUniform gBufferTexModelUniform, gBufferTexMaterialUniform;
+    GLSLUniform gBufferInstancedModelUniform;
+    GLSLUniform lightingInverseViewProjectionUniform, lightingLightSpaceUniform;
+    GLSLUniform lightingCascadeSplitsUniform, lightingCascadeBiasUniform;
+    GLSLUniform lightingShadowLightDirUniform;
+
+    // Constant uniforms and handles are set up as each program finishes linking
+    depthShader.onReady([&](GLSLProgram &program) {
+        depthLightSpaceUniform = program.getUniform("lightSpaceMatrix");
+        depthModelUniform = program.getUniform("model");
+    });
+
+    depthInstancedShader.onReady([&](GLSLProgram &program) {
+        depthInstancedLightSpaceUniform = program.getUniform("lightSpaceMatrix");
+        depthInstancedModelUniform = program.getUniform("model");
+    });
+
+    // The vertex stage hands world positions to the geometry shader, which
+    // projects them onto each cube face itself
+    pointDepthShader.onReady([&](GLSLProgram &program) {
+        program.use();
+
+        program.setUniform("lightSpaceMatrix", glm::mat4());
+        program.setUniform(program.getUniform("faceMatrices"), pointShadows.getFaceMatrices(), 6);
+        program.setUniform("farPlane", pointShadows.getFarPlane());
+
+        pointDepthLightsUniform = program.getUniform("lights");
+        pointDepthNumLightsUniform = program.getUniform("numLights");
+        pointDepthModelUniform = program.getUniform("model");
+    });
+
+    pointDepthInstancedShader.onReady([&](GLSLProgram &program) {
+        program.use();
+
+        program.setUniform("lightSpaceMatrix", glm::mat4());
+        program.setUniform(program.getUniform("faceMatrices"), pointShadows.getFaceMatrices(), 6);
+        program.setUniform("farPlane", pointShadows.getFarPlane());
+
+        pointDepthInstancedLightsUniform = program.getUniform("lights");
+        pointDepthInstancedNumLightsUniform = program.getUniform("numLights");
+        pointDepthInstancedModelUniform = program.getUniform("model");
+    });
+
+    clusterShader.onReady([&](GLSLProgram &program) {
+        program.use();
+
+        program.setUniform("nearPlane", lightClusters.getNearPlane());
+        program.setUniform("farPlane", lightClusters.getFarPlane());
+
+        clusterInverseProjectionUniform = program.getUniform("inverseProjection");
+        clusterViewUniform = program.getUniform("view");
+    });
+
+    lampShader.onReady([&](GLSLProgram &program) {
+        lampModelUniform = program.getUniform("model");
+    });
+
+    floorShader.onReady([&](GLSLProgram &program) {
+        // Set texture units
+        program.use();
+
+        program.setUniform(program.getUniform("materialPages"), materialUnits,
+                           MaterialLibrary::MAX_PAGES);
+        program.setUniform("materialIndex", floorMaterial);
+        program.setUniform("shadowMap", 3);
+        program.setUniform("pointShadowMap", 4);
+        program.setUniform("numPointShadows", pointShadows.getNumLights());
+        program.setUniform("pointShadowFar", pointShadows.getFarPlane());
+
+        floorModelUniform = program.getUniform("model");
+        floorLightSpaceUniform = program.getUniform("lightSpaceMatrices");
+        floorCascadeSplitsUniform = program.getUniform("cascadeSplits");
+        floorCascadeBiasUniform = program.getUniform("cascadeBias");
+        floorShadowLightDirUniform = program.getUniform("shadowLightDir");
+    });
+
+    wallShader.onReady([&](GLSLProgram &program) {
+        program.use();
+
+        program.setUniform(program.getUniform("materialPages"), materialUnits,
+                           MaterialLibrary::MAX_PAGES);
+        program.setUniform("materialIndex", wallMaterial);
+
+        wallModelUniform = program.getUniform("model");
+    });
+
+    diamondShader.onReady([&](GLSLProgram &program) {
+        program.use();
+
+        program.setUniform("dirLight.direction", glm::vec3(0.0f, 1.0f, 0.0f));
+        program.setUniform("dirLight.ambient", glm::vec3(0.08f) * tungsten100W);
+        program.setUniform("dirLight.diffuse", glm::vec3(0.5f) * tungsten100W);
+        program.setUniform("dirLight.specular", glm::vec3(0.5f) * tungsten100W);
+
+        diamondModelUniform = program.getUniform("model");
+    });
+
+    gBufferTexShader.onReady([&](GLSLProgram &program) {
+        program.use();
+
+        program.setUniform(program.getUniform("materialPages"), materialUnits,
+                           MaterialLibrary::MAX_PAGES);
+
+        gBufferTexModelUniform = program.getUniform("model");
+        gBufferTexMaterialUniform = program.getUniform("materialIndex");
+    });
+
+    gBufferInstancedShader.onReady([&](GLSLProgram &program) {
+        program.use();
 
-    diamondShader.use();
+        program.setUniform("flags", SURFACE_DIR_LIT);
 
-    diamondShader.setUniform("numDirs", 1);
-    diamondShader.setUniform("dirLight.direction", glm::vec3(0.0f, 1.0f, 0.0f));
-    diamondShader.setUniform("dirLight.ambient", glm::vec3(0.08f) * tungsten100W);
-    diamondShader.setUniform("dirLight.diffuse", glm::vec3(0.5f) * tungsten100W);
-    diamondShader.setUniform("dirLight.specular", glm::vec3(0.5f) * tungsten100W);
+        gBufferInstancedModelUniform = program.getUniform("model");
+    });
 
+    lightingShader.onReady([&](GLSLProgram &program) {
+        program.use();
 
-    diamondShader.setUniform("numPoints", 6);
-    diamondShader.setUniform("pointLight.constant", 1.0f);
-    diamondShader.setUniform("pointLight.linear", 0.09f);
-    diamondShader.setUniform("pointLight.quadratic", 0.032f);
+        program.setUniform("numPointShadows", pointShadows.getNumLights());
+        program.setUniform("pointShadowFar", pointShadows.getFarPlane());
 
-    diamondShader.setUniform("pointLight.ambient", glm::vec3(0.08f) * halogen);
-    diamondShader.setUniform("pointLight.diffuse", glm::vec3(0.7f) * halogen);
-    diamondShader.setUniform("pointLight.specular", glm::vec3(2.0f) * halogen);
+        // The diamonds' fill light
+        program.setUniform("dirLight.direction", glm::vec3(0.0f, 1.0f, 0.0f));
+        program.setUniform("dirLight.ambient", glm::vec3(0.08f) * tungsten100W);
+        program.setUniform("dirLight.diffuse", glm::vec3(0.5f) * tungsten100W);
+        program.setUniform("dirLight.specular", glm::vec3(0.5f) * tungsten100W);
 
-    glUniform3fv(glGetUniformLocation(diamondShader.getHandle(),
-                 "pointLightPos"), 6, glm::value_ptr(pointLightPos[0]));
+        lightingInverseViewProjectionUniform = program.getUniform("inverseViewProjection");
+        lightingLightSpaceUniform = program.getUniform("lightSpaceMatrices");
+        lightingCascadeSplitsUniform = program.getUniform("cascadeSplits");
+        lightingCascadeBiasUniform = program.getUniform("cascadeBias");
+        lightingShadowLightDirUniform = program.getUniform("shadowLightDir");
+    });
 
     /*
     diamondShader.setUniform("numSpots", 24);
@@ -314,20 +713,101 @@ int main()
 
     glm::mat4 model;
 
+    // Scene draws go through the queue, sorted by state and depth
+    RenderQueue renderQueue;
+
+    auto planeItem = [](GLSLProgram &program, const VBOPlane &plane)
+    {
+        return DrawItem(program, plane.getVertexArrayHandle(), plane.getIndexType(),
+                        plane.getIndexCount());
+    };
+
+    // The floor and the four walls and the ceiling, drawn by either shading path
+    const glm::mat4 floorModel = glm::translate(glm::vec3(0.0f, -1.0f, 0.0f));
+    const glm::mat4 wallModels[4] = {
+        glm::translate(glm::vec3(0.0f, 2.0f, -7.5f)) *
+            glm::rotate(glm::radians(90.0f), vec3(1.0f, 0.0f, 0.0f)),
+        glm::translate(glm::vec3(-7.5f, 2.0f, 0.0f)) *
+            glm::rotate(glm::radians(90.0f), vec3(0.0f, 1.0f, 0.0f)) *
+            glm::rotate(glm::radians(90.0f), vec3(1.0f, 0.0f, 0.0f)),
+        glm::translate(glm::vec3(7.5f, 2.0f, 0.0f)) *
+            glm::rotate(glm::radians(-90.0f), vec3(0.0f, 1.0f, 0.0f)) *
+            glm::rotate(glm::radians(90.0f), vec3(1.0f, 0.0f, 0.0f)),
+        glm::translate(glm::vec3(0.0f, 2.0f, 7.5f)) *
+            glm::rotate(glm::radians(180.0f), vec3(0.0f, 1.0f, 0.0f)) *
+            glm::rotate(glm::radians(90.0f), vec3(1.0f, 0.0f, 0.0f))
+    };
+    const glm::mat4 ceilingModel = glm::translate(glm::vec3(0.0f, 5.0f, 0.0f)) *
+                                   glm::rotate(glm::radians(180.0f), vec3(1.0f, 0.0f, 0.0f));
+
+    auto submitWalls = [&](GLSLProgram &program, GLSLUniform modelUniform,
+                           GLSLUniform materialUniform)
+    {
+        DrawItem item = planeItem(program, wall);
+        item.modelUniform = modelUniform;
+        item.materialUniform = materialUniform;
+        item.material = wallMaterial;
+        for(int i = 0; i < 4; ++i)
+        {
+            item.model = wallModels[i];
+            renderQueue.submit(item);
+        }
+
+        DrawItem ceiling = planeItem(program, floor);
+        ceiling.modelUniform = modelUniform;
+        ceiling.materialUniform = materialUniform;
+        ceiling.material = wallMaterial;
+        ceiling.model = ceilingModel;
+        renderQueue.submit(ceiling);
+    };
+
+    auto submitDiamonds = [&](GLSLProgram &program, GLSLUniform modelUniform,
+                              const glm::mat4 &spin)
+    {
+        for(GLsizei i = 0; i < diamond.getNumMeshes(); ++i)
+        {
+            const Mesh &mesh = diamond.getMesh(i);
+            DrawItem item(program, mesh.getVAO(), mesh.getIndexType(), mesh.getIndexCount());
+            item.instances = numDiamonds;
+            item.modelUniform = modelUniform;
+            item.model = spin;
+            renderQueue.submit(item);
+        }
+    };
 
+    // Benchmark frames must all draw the full scene
+    if(headless)
+    {
+        for(GLSLProgram *program : allPrograms)
+            program->wait();
+        textureLoader.finish();
+        frameRateText.finish();
+    }
 
     // Game loop
-    while(!glfwWindowShouldClose(window))
+    while(headless ? !benchmark->isFinished() : !glfwWindowShouldClose(window))
     {
         // Set frame time
-        GLfloat currentFrame = glfwGetTime();
+        GLfloat currentFrame;
+        if(headless)
+        {
+            benchmark->beginFrame();
+            currentFrame = benchmark->getTime();
+        }
+        else
+            currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
 
+        // Swap in any textures the loader threads have finished
+        textureLoader.update();
+        materials.update();
+
         // Setting up the text for the Frame Rate display
         if(frameRateCounter == frameRateCounterTarget)
         {
             frameRate = deltaTime * 1000;
             frameRateString = to_string(frameRate);
+            frameRateLabel.setText(frameRateString);
             frameRateCounter = 0;
         }
 
@@ -336,206 +816,298 @@ int main()
         lastFrame = currentFrame;
 
         // Check and call events
-        glfwPollEvents();
-        doMovement();
+        if(headless)
+        {
+            glm::vec3 cameraPos, cameraTarget;
+            Benchmark::cameraPath(currentFrame, cameraPos, cameraTarget);
+            camera.LookAt(cameraPos, cameraTarget);
+        }
+        else
+        {
+            glfwPollEvents();
+            doMovement();
+        }
 
         // Clear the colorbuffer
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         //glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        GLfloat rotation = (GLfloat)glfwGetTime() * glm::radians(50.0f);
+        GLfloat rotation = currentFrame * glm::radians(50.0f);
 
 
         // ------ SHADOW MAP PASS ------ //
 
-        glm::mat4 lightProjection, lightView;
-        glm::mat4 lightSpaceMatrix;
+        beginPass("shadow");
+
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom),
+                                                (float)screenWidth/
+                                                (float)screenHeight, 0.1f,
+                                                100.0f);
+
+        glm::mat4 view = camera.GetViewMatrix();
 
-        GLfloat near_plane = 1.0f, far_plane = 7.0f;
+        // The overhead light shines straight down on the scene
+        shadowMap.update(view, glm::radians(camera.Zoom),
+                         (float)screenWidth / (float)screenHeight, 0.1f,
+                         SHADOW_DISTANCE, -lightPos);
 
-        //lightProjection = glm::perspective(glm::radians(100.0f), (GLfloat)SHADOW_WIDTH /
-        //                                   (GLfloat)SHADOW_HEIGHT, near_plane,
-        //                                   far_plane);
+        // Cull the diamonds against each cascade
+        shadowInstanceIds.clear();
+        for(int c = 0; c < shadowMap.getNumCascades(); ++c)
+        {
+            cascadeFirst[c] = numDiamonds + (GLsizei)shadowInstanceIds.size();
+            for(GLint i = 0; i < numDiamonds; ++i)
+                if(shadowMap.isVisible(c, glm::vec3(diamondInstances[i].Model[3]), diamondRadius))
+                    shadowInstanceIds.push_back(i);
+            cascadeCount[c] = numDiamonds + (GLsizei)shadowInstanceIds.size() - cascadeFirst[c];
+        }
+        if(shadowInstanceIds != previousShadowInstanceIds)
+        {
+            shadowInstances.clear();
+            for(GLint id : shadowInstanceIds)
+                shadowInstances.push_back(diamondInstances[id]);
+            diamond.setInstances(shadowInstances, numDiamonds);
+            previousShadowInstanceIds.swap(shadowInstanceIds);
+        }
 
-        lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, near_plane, far_plane);
+        // All diamonds share one spin, applied before each instance's translation
+        glm::mat4 diamondSpin = glm::rotate(rotation, vec3(0.0f, 1.0f, 0.0f));
 
-        lightView = glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(1.0));
+        // The floor never moves, so it is only drawn when a cascade's static
+        // layer has to be rebuilt; the spinning diamonds are drawn every frame
+        auto renderStaticCasters = [&](int c)
+        {
+            //------ Setup and Render the Floor ------
 
-        //lightView = glm::lookAt(pointLightPos[0], glm::vec3(pointLightPos[0].x, -1.0f, pointLightPos[0].z), glm::vec3(1.0));
-        lightSpaceMatrix = lightProjection * lightView;
+            if(shadowMap.isVisible(c, floorCenter, floorRadius))
+            {
+                depthShader.use();
 
-        //------ Setup and Render the Floor ------
+                depthShader.setUniform(depthLightSpaceUniform, shadowMap.getLightSpaceMatrix(c));
 
-        depthShader.use();
+                model = glm::mat4();
+                model *= glm::translate(glm::vec3(0.0f, -1.0f, 0.0f));
+                depthShader.setUniform(depthModelUniform, model);
 
-        depthShader.setUniform("lightSpaceMatrix", lightSpaceMatrix);
-        //glUniformMatrix4fv(glGetUniformLocation(depthShader.getHandle(), "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+                floor.render();
+            }
+        };
 
-        model = glm::mat4();
-        model *= glm::translate(glm::vec3(0.0f, -1.0f, 0.0f));
-        depthShader.setUniform("model", model);
+        for(int c = 0; c < shadowMap.getNumCascades(); ++c)
+        {
+            // Not cached until the depth shader is ready to draw into it
+            if(depthShader.isReady() && shadowMap.needsStaticUpdate(c))
+            {
+                shadowMap.beginStaticCascade(c);
+                renderStaticCasters(c);
+            }
 
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
+            shadowMap.beginCascade(c);
+            const glm::mat4 &lightSpaceMatrix = shadowMap.getLightSpaceMatrix(c);
 
-        floor.render();
+            if(depthShader.isReady() && !shadowMap.isStaticCached(c))
+                renderStaticCasters(c);
 
-        //------ Setup and Render the Diamonds ------
+            //------ Setup and Render the Diamonds ------
 
-        for(GLint matObjCounter = 0; matObjCounter < 24; ++matObjCounter)
-        {
-            model = glm::mat4();
-            model *= glm::translate(matObjPositions[matObjCounter]);
-            model *= glm::rotate(rotation, vec3(0.0f, 1.0f, 0.0f));
+            if(depthInstancedShader.isReady() && cascadeCount[c] > 0)
+            {
+                depthInstancedShader.use();
+                depthInstancedShader.setUniform(depthInstancedLightSpaceUniform, lightSpaceMatrix);
+                depthInstancedShader.setUniform(depthInstancedModelUniform, diamondSpin);
 
-            depthShader.setUniform("model", model);
-            diamond.Draw(depthShader, true);
+                diamond.DrawInstanced(depthInstancedShader, cascadeFirst[c], cascadeCount[c], true);
+            }
         }
 
+        // ------ Lamp Shadows ------ //
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        // Every lamp reaches a spinning diamond, so all of them go stale each
+        // frame and the budget decides which are redrawn; lamps whose range
+        // is out of view wait until it comes back
+        if(pointDepthShader.isReady() && pointDepthInstancedShader.isReady())
+        {
+            pointShadows.invalidateAll();
+            if(pointShadows.schedule(projection * view) > 0)
+            {
+                pointShadows.begin();
+
+                pointDepthShader.use();
+                pointDepthShader.setUniform(pointDepthLightsUniform, pointShadows.getBatch(),
+                                            pointShadows.getBatchSize());
+                pointDepthShader.setUniform(pointDepthNumLightsUniform, pointShadows.getBatchSize());
+                model = glm::mat4();
+                model *= glm::translate(glm::vec3(0.0f, -1.0f, 0.0f));
+                pointDepthShader.setUniform(pointDepthModelUniform, model);
+                floor.render();
+
+                pointDepthInstancedShader.use();
+                pointDepthInstancedShader.setUniform(pointDepthInstancedLightsUniform,
+                                                     pointShadows.getBatch(),
+                                                     pointShadows.getBatchSize());
+                pointDepthInstancedShader.setUniform(pointDepthInstancedNumLightsUniform,
+                                                     pointShadows.getBatchSize());
+                pointDepthInstancedShader.setUniform(pointDepthInstancedModelUniform, diamondSpin);
+                diamond.DrawInstanced(pointDepthInstancedShader, 0, numDiamonds, true);
+            }
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
         glViewport(0, 0, screenWidth, screenHeight);
 
+        endPass();
 
-        // ------ Normal Render Pass ------ //
 
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom),
-                                                (float)screenWidth/
-                                                (float)screenHeight, 0.1f,
-                                                100.0f);
+        // ------ Light Culling ------ //
 
-        glm::mat4 view = camera.GetViewMatrix();
+        beginPass("light culling");
 
+        if(clusterShader.isReady())
+        {
+            clusterShader.use();
+            clusterShader.setUniform(clusterInverseProjectionUniform, glm::inverse(projection));
+            clusterShader.setUniform(clusterViewUniform, view);
+            lightClusters.cull();
+        }
+
+        endPass();
+
+
+        // ------ Normal Render Pass ------ //
+
+        cameraBlock.projection = projection;
+        cameraBlock.view = view;
+        cameraBlock.viewPos = glm::vec4(camera.Position, 1.0f);
+        cameraUBO.update(&cameraBlock, sizeof(CameraBlock));
 
-        //------ Setup and Render the Lamp ------
+        renderQueue.begin(view, 100.0f);
 
-        lampShader.use();
 
-        lampShader.setUniform("view", view);
-        lampShader.setUniform("projection", projection);
+        //------ Deferred Geometry and Lighting ------
 
-        for(int x=0; x < 6; x++)
+        // Ahead of the lamps and text, which depth test against the result
+        if(deferred)
         {
-            model = glm::mat4();
-            model = glm::translate(model, pointLightPos[x]);
-            model = glm::scale(model, glm::vec3(0.2f));
-            lampShader.setUniform("model", model);
-            cube.render();
-        }
+            beginPass("geometry");
 
-        glBindVertexArray(0);
+            gBuffer.bind();
 
+            if(gBufferTexShader.isReady())
+            {
+                DrawItem item = planeItem(gBufferTexShader, floor);
+                item.modelUniform = gBufferTexModelUniform;
+                item.model = floorModel;
+                item.materialUniform = gBufferTexMaterialUniform;
+                item.material = floorMaterial;
+                renderQueue.submit(item);
 
-        //------ Render the Framerate Text ------
+                submitWalls(gBufferTexShader, gBufferTexModelUniform, gBufferTexMaterialUniform);
+            }
 
-        frameRateText.render(textShader, frameRateString, screenWidth - 130.0f,
-                             screenHeight - 30.0f, 0.5f,
-                             glm::vec3(0.2f, 0.6f, 0.2f));
+            if(gBufferInstancedShader.isReady())
+                submitDiamonds(gBufferInstancedShader, gBufferInstancedModelUniform, diamondSpin);
 
+            renderQueue.flush();
 
-        //------ Setup and Render the Floor ------
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+            glViewport(0, 0, screenWidth, screenHeight);
 
-        floorShader.use();
+            endPass();
 
-        floorShader.setUniform("projection", projection);
-        floorShader.setUniform("view", view);
 
-        model = glm::mat4();
-        model *= glm::translate(glm::vec3(0.0f, -1.0f, 0.0f));
-        floorShader.setUniform("model", model);
-        floorShader.setUniform("viewPos", camera.Position);
+            beginPass("lighting");
 
-        floorShader.setUniform("lightSpaceMatrix", lightSpaceMatrix);
+            if(lightingShader.isReady())
+            {
+                lightingShader.use();
 
-        // Bind diffuse map
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, floorTexture);
-        // Bind specular map
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, floorSpec);
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
+                lightingShader.setUniform(lightingInverseViewProjectionUniform,
+                                          glm::inverse(projection * view));
+                lightingShader.setUniform(lightingLightSpaceUniform, shadowMap.getLightSpaceMatrices(),
+                                          shadowMap.getNumCascades());
+                lightingShader.setUniform(lightingCascadeSplitsUniform, shadowMap.getSplits(),
+                                          shadowMap.getNumCascades());
+                lightingShader.setUniform(lightingCascadeBiasUniform, shadowMap.getDepthBias(),
+                                          shadowMap.getNumCascades());
+                lightingShader.setUniform(lightingShadowLightDirUniform, shadowMap.getLightDirection());
 
-        floor.render();
+                gBuffer.bindTextures(0);
+                shadowMap.bindTexture(4);
+                pointShadows.bindTexture(5);
 
+                // Copies the G-buffer depth out along with the colour
+                glDepthFunc(GL_ALWAYS);
+                glBindVertexArray(fullscreenVAO);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+                glBindVertexArray(0);
+                glDepthFunc(GL_LESS);
+            }
 
-        //------ Setup and Render the Walls ------
+            endPass();
+        }
 
-        wallShader.use();
 
-        wallShader.setUniform("projection", projection);
-        wallShader.setUniform("view", view);
-        wallShader.setUniform("viewPos", camera.Position);
+        //------ Setup and Render the Scene ------
 
-        // Bind diffuse map
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, wallTexture);
-        // Bind specular map
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, wallSpec);
-
-        model = glm::mat4();
-        model *= glm::translate(glm::vec3(0.0f, 2.0f, -7.5f));
-        model *= glm::rotate(glm::radians(90.0f), vec3(1.0f, 0.0f, 0.0f));
-        wallShader.setUniform("model", model);
-        wall.render();
-
-        model = glm::mat4();
-        model *= glm::translate(glm::vec3(-7.5f, 2.0f, 0.0f));
-        model *= glm::rotate(glm::radians(90.0f), vec3(0.0f, 1.0f, 0.0f));
-        model *= glm::rotate(glm::radians(90.0f), vec3(1.0f, 0.0f, 0.0f));
-        wallShader.setUniform("model", model);
-        wall.render();
-
-        model = glm::mat4();
-        model *= glm::translate(glm::vec3(7.5f, 2.0f, 0.0f));
-        model *= glm::rotate(glm::radians(-90.0f), vec3(0.0f, 1.0f, 0.0f));
-        model *= glm::rotate(glm::radians(90.0f), vec3(1.0f, 0.0f, 0.0f));
-        wallShader.setUniform("model", model);
-        wall.render();
-
-        model = glm::mat4();
-        model *= glm::translate(glm::vec3(0.0f, 2.0f, 7.5f));
-        model *= glm::rotate(glm::radians(180.0f), vec3(0.0f, 1.0f, 0.0f));
-        model *= glm::rotate(glm::radians(90.0f), vec3(1.0f, 0.0f, 0.0f));
-        wallShader.setUniform("model", model);
-        wall.render();
-
-        model = glm::mat4();
-        model *= glm::translate(glm::vec3(0.0f, 5.0f, 0.0f));
-        model *= glm::rotate(glm::radians(180.0f), vec3(1.0f, 0.0f, 0.0f));
-        wallShader.setUniform("model", model);
-        floor.render();
-
-
-
-        //------ Setup and Render the Diamonds ------
-
-        diamondShader.use();
-
-        diamondShader.setUniform("projection", projection);
-        diamondShader.setUniform("view", view);
-        diamondShader.setUniform("viewPos", camera.Position);
-
-        for(GLint matObjCounter = 0; matObjCounter < 24; ++matObjCounter)
+        // The forward path's surfaces and, on either path, the lamps
+        beginPass("scene");
+
+        if(!deferred && floorShader.isReady())
         {
-            stdMaterial matObjMat = stdMatMap[matList[matObjCounter]];
+            // Per-frame state of the floor program, which the queue leaves alone
+            floorShader.use();
+
+            floorShader.setUniform(floorLightSpaceUniform, shadowMap.getLightSpaceMatrices(),
+                                   shadowMap.getNumCascades());
+            floorShader.setUniform(floorCascadeSplitsUniform, shadowMap.getSplits(),
+                                   shadowMap.getNumCascades());
+            floorShader.setUniform(floorCascadeBiasUniform, shadowMap.getDepthBias(),
+                                   shadowMap.getNumCascades());
+            floorShader.setUniform(floorShadowLightDirUniform, shadowMap.getLightDirection());
+
+            shadowMap.bindTexture(3);
+            pointShadows.bindTexture(4);
+
+            DrawItem item = planeItem(floorShader, floor);
+            item.modelUniform = floorModelUniform;
+            item.model = floorModel;
+            renderQueue.submit(item);
+        }
 
-            model = glm::mat4();
-            model *= glm::translate(matObjPositions[matObjCounter]);
-            model *= glm::rotate(rotation, vec3(0.0f, 1.0f, 0.0f));
+        if(!deferred && wallShader.isReady())
+            submitWalls(wallShader, wallModelUniform, GLSLUniform());
 
-            diamondShader.setUniform("model", model);
-            diamondShader.setUniform("material.ambient", matObjMat.ambient);
-            diamondShader.setUniform("material.diffuse", matObjMat.diffuse);
-            diamondShader.setUniform("material.specular", matObjMat.specular);
-            diamondShader.setUniform("material.shininess", matObjMat.shininess);
+        if(!deferred && diamondShader.isReady())
+            submitDiamonds(diamondShader, diamondModelUniform, diamondSpin);
 
-            diamond.Draw(diamondShader);
+        if(lampShader.isReady())
+        {
+            DrawItem item(lampShader, cube.getVertexArrayHandle(), cube.getIndexType(),
+                          cube.getIndexCount());
+            item.modelUniform = lampModelUniform;
+            for(int x=0; x < 6; x++)
+            {
+                item.model = glm::translate(pointLightPos[x]) * glm::scale(glm::vec3(0.2f));
+                renderQueue.submit(item);
+            }
         }
 
+        renderQueue.flush();
+
+        endPass();
+
+
+        //------ Render the Framerate Text ------
+
+        // Last, over the scene
+        beginPass("text");
+
+        frameRateLabel.render(textShader, screenWidth - 130.0f, screenHeight - 30.0f,
+                              glm::vec3(0.2f, 0.6f, 0.2f));
+
+        endPass();
+
 /*
 
 
@@ -548,14 +1120,60 @@ int main()
         RenderQuad();
 
 */
-        glfwSwapBuffers(window);
+        if(headless)
+            benchmark->endFrame();
+        else
+            glfwSwapBuffers(window);
+
+        if(!allProgramsReady)
+        {
+            allProgramsReady = true;
+            for(GLSLProgram *program : allPrograms)
+                if(!program->isReady())
+                    allProgramsReady = false;
+
+            if(allProgramsReady)
+            {
+                shaderTime = chrono::steady_clock::now() - shaderStart;
+                printf("All shader programs ready after %.1f ms.\n", shaderTime.count());
+            }
+        }
+
+        if(!allTexturesReady && textureLoader.getPending() == 0)
+        {
+            allTexturesReady = true;
+            chrono::duration<double, milli> textureTime = chrono::steady_clock::now() - textureStart;
+            printf("All textures loaded after %.1f ms.\n", textureTime.count());
+        }
     }
 
-    glfwTerminate();
+    if(headless)
+    {
+        printf("Render queue: %d draws with %d state changes in the last frame.\n",
+               renderQueue.getDraws(), renderQueue.getStateChanges());
+        benchmark->writeReport(reportPath, screenWidth, screenHeight);
+        delete benchmark;
+        benchmark = nullptr;
+    }
+    else
+        glfwTerminate();
 
     return 0;
 }
 
+// Pass timing hooks for the benchmark mode, no-ops when running interactively
+void beginPass(const char *name)
+{
+    if(benchmark)
+        benchmark->beginPass(name);
+}
+
+void endPass()
+{
+    if(benchmark)
+        benchmark->endPass();
+}
+
 
 // This function loads a texture from file. Note: texture loading functions like these are usually
 // managed by a 'Resource Manager' that manages all resources (like textures, models, audio).
@@ -563,6 +1181,9 @@ int main()
 
 GLuint loadTexture(GLchar* path, bool sRGB)
 {
+    if(TextureLoader::getShared() != NULL)
+        return TextureLoader::getShared()->load(path, sRGB);
+
     // Generate texture ID and load texture data
     GLuint textureID;
     glGenTextures(1, &textureID);
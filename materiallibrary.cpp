@@ -0,0 +1,225 @@
+#include "materiallibrary.h"
+#include "textureloader.h"
+
+#include <iostream>
+
+using namespace std;
+
+namespace {
+    // One material as the shaders see it (std430)
+    struct MaterialData {
+        GLuint layers[4];       // diffuse page, diffuse layer, specular page, specular layer
+        GLfloat params[4];      // shininess, diffuse strength, specular strength, surface flags
+    };
+
+    // Layers a new page starts with
+    const GLsizei INITIAL_CAPACITY = 4;
+
+    // Texture storage needs a sized format
+    GLenum sizedFormat( GLenum format )
+    {
+        switch( format ) {
+            case GL_RGB:  return GL_RGB8;
+            case GL_RGBA: return GL_RGBA8;
+            case GL_SRGB: return GL_SRGB8;
+            default:      return format;
+        }
+    }
+}
+
+MaterialLibrary::MaterialLibrary( TextureLoader * loader ) : loader(loader), buffer(0), dirty(true)
+{
+}
+
+MaterialLibrary::~MaterialLibrary()
+{
+    for( size_t i = 0; i < pages.size(); ++i )
+        glDeleteTextures(1, &pages[i].texture);
+    if( buffer != 0 )
+        glDeleteBuffers(1, &buffer);
+
+    for( map<GLuint, int>::iterator it = sources.begin(); it != sources.end(); ++it )
+        releaseSource(it->first, it->second);
+}
+
+GLuint MaterialLibrary::add( GLuint diffuse, GLuint specular, float shininess,
+                             float diffuseStrength, float specularStrength, GLuint flags )
+{
+    // A texture added again after it was copied gets a layer of its own
+    sources[diffuse]++;
+    sources[specular]++;
+
+    Material material = { diffuse, specular, { NO_PAGE, 0 }, { NO_PAGE, 0 },
+                          shininess, diffuseStrength, specularStrength, flags };
+    materials.push_back(material);
+    dirty = true;
+    return (GLuint)materials.size() - 1;
+}
+
+void MaterialLibrary::update()
+{
+    for( map<GLuint, int>::iterator it = sources.begin(); it != sources.end(); ) {
+        Slot slot;
+        if( (loader != NULL && !loader->isLoaded(it->first)) || !place(it->first, slot) ) {
+            ++it;
+            continue;
+        }
+        assign(it->first, slot);
+        releaseSource(it->first, it->second);
+        sources.erase(it++);
+        dirty = true;
+    }
+
+    if( !dirty )
+        return;
+    dirty = false;
+
+    vector<MaterialData> table(materials.size());
+    for( size_t i = 0; i < materials.size(); ++i ) {
+        const Slot & diffuse = materials[i].diffuseSlot;
+        const Slot & specular = materials[i].specularSlot;
+        MaterialData data = {
+            { diffuse.page, diffuse.layer, specular.page, specular.layer },
+            { materials[i].shininess, materials[i].diffuseStrength,
+              materials[i].specularStrength, (GLfloat)materials[i].flags }
+        };
+        table[i] = data;
+    }
+
+    if( buffer == 0 )
+        glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, max(table.size(), (size_t)1) * sizeof(MaterialData),
+                 table.empty() ? NULL : &table[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    bind();
+}
+
+// Copies a loaded 2D texture into a free layer of the page matching it.
+// When every page is taken by other sizes and formats the texture is
+// given up on, and its materials keep sampling grey.
+bool MaterialLibrary::place( GLuint texture, Slot & slot )
+{
+    GLint width = 0, height = 0, format = 0;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+
+    // The levels actually defined, which for a KTX file may stop short of 1x1
+    GLsizei levels = 1;
+    for( GLint w = width, h = height; w > 1 || h > 1; ++levels ) {
+        GLint levelWidth = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, levels, GL_TEXTURE_WIDTH, &levelWidth);
+        if( levelWidth == 0 )
+            break;
+        w = max(w / 2, 1);
+        h = max(h / 2, 1);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if( width == 0 || height == 0 )
+        return false;
+
+    size_t index = 0;
+    while( index < pages.size() &&
+           !(pages[index].width == width && pages[index].height == height &&
+             pages[index].format == sizedFormat(format) && pages[index].levels == levels) )
+        ++index;
+
+    if( index == pages.size() ) {
+        if( pages.size() == (size_t)MAX_PAGES ) {
+            cerr << "Material texture pages are full, texture " << texture << " left out" << endl;
+            slot.page = NO_PAGE;
+            slot.layer = 0;
+            return true;
+        }
+        Page page = { 0, width, height, sizedFormat(format), levels, 0, 0 };
+        pages.push_back(page);
+    }
+
+    Page & page = pages[index];
+    if( page.layers == page.capacity )
+        grow(page);
+
+    for( GLsizei level = 0; level < levels; ++level )
+        glCopyImageSubData(texture, GL_TEXTURE_2D, level, 0, 0, 0,
+                           page.texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, page.layers,
+                           max(width >> level, 1), max(height >> level, 1), 1);
+
+    slot.page = (GLuint)index;
+    slot.layer = (GLuint)page.layers++;
+    return true;
+}
+
+// Reallocates the page with twice the layers, keeping the ones it has
+void MaterialLibrary::grow( Page & page )
+{
+    GLsizei capacity = page.capacity == 0 ? INITIAL_CAPACITY : page.capacity * 2;
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, page.levels, page.format, page.width, page.height,
+                   capacity);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                    page.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    if( page.texture != 0 ) {
+        for( GLsizei level = 0; level < page.levels; ++level )
+            glCopyImageSubData(page.texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+                               texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+                               max(page.width >> level, 1), max(page.height >> level, 1),
+                               page.layers);
+        glDeleteTextures(1, &page.texture);
+    }
+
+    page.texture = texture;
+    page.capacity = capacity;
+}
+
+void MaterialLibrary::assign( GLuint texture, const Slot & slot )
+{
+    for( size_t i = 0; i < materials.size(); ++i ) {
+        if( materials[i].diffuse == texture ) {
+            materials[i].diffuse = 0;
+            materials[i].diffuseSlot = slot;
+        }
+        if( materials[i].specular == texture ) {
+            materials[i].specular = 0;
+            materials[i].specularSlot = slot;
+        }
+    }
+}
+
+void MaterialLibrary::releaseSource( GLuint texture, int refs )
+{
+    if( loader == NULL ) {
+        glDeleteTextures(1, &texture);
+        return;
+    }
+    for( int i = 0; i < refs; ++i )
+        loader->release(texture);
+}
+
+void MaterialLibrary::bind()
+{
+    for( size_t i = 0; i < pages.size(); ++i ) {
+        glActiveTexture(GL_TEXTURE0 + FIRST_UNIT + (GLuint)i);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, pages[i].texture);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    if( buffer != 0 )
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING, buffer);
+}
+
+int MaterialLibrary::getNumPages()
+{
+    return (int)pages.size();
+}
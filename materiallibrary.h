@@ -0,0 +1,93 @@
+#ifndef MATERIALLIBRARY_H
+#define MATERIALLIBRARY_H
+
+#include "cookbookogl.h"
+
+#include <map>
+#include <vector>
+
+class TextureLoader;
+
+// Textured materials drawn without per-draw texture binds. Every texture
+// is copied into a layer of a GL_TEXTURE_2D_ARRAY page shared by all the
+// textures of its size, format and mip count. The pages stay bound to
+// units FIRST_UNIT on, and the material table (page and layer of each
+// texture plus the shading parameters) sits in a shader storage buffer,
+// so a draw only needs the index of its material.
+//
+// Textures arrive from the TextureLoader in the background; until one has
+// been copied into a page its material samples as mid grey. Once copied,
+// the library drops its reference to the 2D texture, so the loader's cache
+// can evict it.
+class MaterialLibrary
+{
+  public:
+    static const int MAX_PAGES = 8;
+    static const GLuint FIRST_UNIT = 8;     // Units FIRST_UNIT to FIRST_UNIT + MAX_PAGES - 1
+    static const GLuint BINDING = 4;        // Shader storage binding of the table
+    static const GLuint NO_PAGE = 0xFFFFFFFF;
+
+  private:
+    struct Page {
+        GLuint texture;
+        GLsizei width, height;
+        GLenum format;
+        GLsizei levels;
+        GLsizei layers;
+        GLsizei capacity;
+    };
+
+    struct Slot {
+        GLuint page;
+        GLuint layer;
+    };
+
+    struct Material {
+        GLuint diffuse, specular;       // 2D textures still waiting for a slot, or 0
+        Slot diffuseSlot, specularSlot;
+        float shininess;
+        float diffuseStrength;
+        float specularStrength;
+        GLuint flags;
+    };
+
+    TextureLoader * loader;
+    std::vector<Page> pages;
+    std::map<GLuint, int> sources;      // 2D textures waiting for a slot, with their references
+    std::vector<Material> materials;
+    GLuint buffer;
+    bool dirty;
+
+    bool   place( GLuint texture, Slot & slot );
+    void   grow( Page & page );
+    void   releaseSource( GLuint texture, int refs );
+    void   assign( GLuint texture, const Slot & slot );
+
+    // Non-copyable
+    MaterialLibrary( const MaterialLibrary & other ) { }
+    MaterialLibrary & operator=( const MaterialLibrary &other ) { return *this; }
+
+  public:
+    // loader NULL means the textures are complete when added
+    MaterialLibrary( TextureLoader * loader = NULL );
+    ~MaterialLibrary();
+
+    // Takes over the references to the 2D textures. flags are the surface
+    // flags the deferred path writes to the G-buffer. Returns the index the
+    // shaders look the material up by.
+    GLuint add( GLuint diffuse, GLuint specular, float shininess,
+                float diffuseStrength = 1.0f, float specularStrength = 1.0f,
+                GLuint flags = 0 );
+
+    // Copies the textures that have finished loading into their pages and
+    // uploads the table when it changed. Call once a frame, after
+    // TextureLoader::update.
+    void   update();
+
+    // Binds the pages and the table. update() does this when they change.
+    void   bind();
+
+    int    getNumPages();
+};
+
+#endif // MATERIALLIBRARY_H
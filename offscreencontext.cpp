@@ -0,0 +1,130 @@
+#include "offscreencontext.h"
+
+#include <EGL/eglext.h>
+
+#include <cstdlib>
+#include <cstring>
+
+OffscreenContext::OffscreenContext() :
+    display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT),
+    fbo(0), colorBuffer(0), depthBuffer(0), width(0), height(0) { }
+
+OffscreenContext::~OffscreenContext()
+{
+    if( fbo != 0 ) {
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &colorBuffer);
+        glDeleteRenderbuffers(1, &depthBuffer);
+    }
+
+    if( display != EGL_NO_DISPLAY ) {
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if( context != EGL_NO_CONTEXT )
+            eglDestroyContext(display, context);
+        eglTerminate(display);
+    }
+}
+
+void OffscreenContext::create(int width, int height, bool softwareOnly)
+{
+    this->width = width;
+    this->height = height;
+
+    // Don't override a driver choice made by whoever launched us
+    if( softwareOnly )
+        setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+
+    // Prefer the surfaceless platform, it doesn't need X11 or a DRM device
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    const char * clientExts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+    if( getPlatformDisplay && clientExts &&
+        strstr(clientExts, "EGL_MESA_platform_surfaceless") )
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                     EGL_DEFAULT_DISPLAY, NULL);
+
+    if( display == EGL_NO_DISPLAY )
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    if( display == EGL_NO_DISPLAY )
+        throw OffscreenContextException("Unable to open an EGL display.");
+
+    EGLint major, minor;
+    if( !eglInitialize(display, &major, &minor) )
+        throw OffscreenContextException("Unable to initialize EGL.");
+
+    const char * displayExts = eglQueryString(display, EGL_EXTENSIONS);
+    if( !displayExts || !strstr(displayExts, "EGL_KHR_surfaceless_context") )
+        throw OffscreenContextException("EGL_KHR_surfaceless_context is not supported.");
+
+    if( !eglBindAPI(EGL_OPENGL_API) )
+        throw OffscreenContextException("Unable to bind the desktop OpenGL API.");
+
+    EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE
+    };
+
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if( !eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) ||
+        numConfigs == 0 )
+        throw OffscreenContextException("No suitable EGL config found.");
+
+    EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    if( context == EGL_NO_CONTEXT )
+        throw OffscreenContextException("Unable to create an OpenGL 4.3 core context.");
+
+    if( !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context) )
+        throw OffscreenContextException("Unable to make the offscreen context current.");
+}
+
+void OffscreenContext::createFramebuffer()
+{
+    glGenRenderbuffers(1, &colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, depthBuffer);
+
+    if( glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE )
+        throw OffscreenContextException("Offscreen framebuffer is incomplete.");
+}
+
+GLuint OffscreenContext::getFramebuffer()
+{
+    return fbo;
+}
+
+int OffscreenContext::getWidth()
+{
+    return width;
+}
+
+int OffscreenContext::getHeight()
+{
+    return height;
+}
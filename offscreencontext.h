@@ -0,0 +1,53 @@
+#ifndef OFFSCREENCONTEXT_H
+#define OFFSCREENCONTEXT_H
+
+#include "cookbookogl.h"
+
+#include <EGL/egl.h>
+
+#include <string>
+using std::string;
+
+#include <stdexcept>
+
+class OffscreenContextException : public std::runtime_error {
+  public:
+    OffscreenContextException( const string & msg ) :
+      std::runtime_error(msg) { }
+};
+
+// A windowless OpenGL 4.3 core context created through EGL, rendering into
+// a framebuffer object instead of a window surface. Used by the benchmark
+// mode so the render loop can run on machines without a display or GPU
+// (Mesa llvmpipe).
+class OffscreenContext
+{
+  private:
+    EGLDisplay display;
+    EGLContext context;
+
+    GLuint fbo, colorBuffer, depthBuffer;
+    int width, height;
+
+    // Non-copyable
+    OffscreenContext( const OffscreenContext & other ) { }
+    OffscreenContext & operator=( const OffscreenContext &other ) { return *this; }
+
+  public:
+    OffscreenContext();
+    ~OffscreenContext();
+
+    // Create the context and make it current. When softwareOnly is set the
+    // Mesa software rasterizer is requested, unless the environment already
+    // chooses a driver.
+    void   create(int width, int height, bool softwareOnly = true);
+
+    // Must be called after the GL function pointers have been loaded.
+    void   createFramebuffer();
+
+    GLuint getFramebuffer();
+    int    getWidth();
+    int    getHeight();
+};
+
+#endif // OFFSCREENCONTEXT_H
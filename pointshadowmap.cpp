@@ -0,0 +1,198 @@
+#include "pointshadowmap.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+PointShadowMap::PointShadowMap() : fbo(0), depthTexture(0), numLights(0), resolution(0),
+    farPlane(15.0f), budget(2), frame(0), batchSize(0)
+{
+}
+
+PointShadowMap::~PointShadowMap()
+{
+    if( depthTexture != 0 )
+        glDeleteTextures(1, &depthTexture);
+    if( fbo != 0 )
+        glDeleteFramebuffers(1, &fbo);
+}
+
+void PointShadowMap::create( int numLights, GLsizei resolution, float farPlane )
+{
+    this->numLights = glm::max(numLights, 1);
+    this->resolution = resolution;
+    this->farPlane = farPlane;
+
+    Light light = { vec3(0.0f), true, -1 };
+    lights.assign(this->numLights, light);
+
+    // Cube map faces in layer order: +x, -x, +y, -y, +z, -z
+    const vec3 directions[6] = {
+        vec3( 1.0f, 0.0f, 0.0f), vec3(-1.0f, 0.0f, 0.0f),
+        vec3( 0.0f, 1.0f, 0.0f), vec3( 0.0f,-1.0f, 0.0f),
+        vec3( 0.0f, 0.0f, 1.0f), vec3( 0.0f, 0.0f,-1.0f)
+    };
+    const vec3 ups[6] = {
+        vec3(0.0f,-1.0f, 0.0f), vec3(0.0f,-1.0f, 0.0f),
+        vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f,-1.0f),
+        vec3(0.0f,-1.0f, 0.0f), vec3(0.0f,-1.0f, 0.0f)
+    };
+    mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, farPlane);
+    for( int i = 0; i < 6; ++i )
+        faceMatrices[i] = projection * glm::lookAt(vec3(0.0f), directions[i], ups[i]);
+
+    if( depthTexture == 0 )
+        glGenTextures(1, &depthTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, depthTexture);
+    glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, GL_DEPTH_COMPONENT32F, resolution, resolution,
+                 this->numLights * 6, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    // Linear filtering of the comparison gives 2x2 PCF for free
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+
+    GLint previous = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+    if( fbo == 0 )
+        glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if( glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE )
+        cerr << "Point shadow map framebuffer is not complete" << endl;
+    // Lights not drawn yet read as unshadowed
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glBindFramebuffer(GL_FRAMEBUFFER, previous);
+}
+
+void PointShadowMap::setUpdateBudget( int lights )
+{
+    budget = glm::clamp(lights, 1, (int)MAX_BATCH);
+}
+
+void PointShadowMap::setLightPosition( int light, const vec3 & position )
+{
+    if( lights[light].position != position ) {
+        lights[light].position = position;
+        lights[light].stale = true;
+    }
+}
+
+void PointShadowMap::invalidate( int light )
+{
+    lights[light].stale = true;
+}
+
+void PointShadowMap::invalidateAll()
+{
+    for( size_t i = 0; i < lights.size(); ++i )
+        lights[i].stale = true;
+}
+
+int PointShadowMap::schedule( const mat4 & viewProjection )
+{
+    ++frame;
+
+    // Frustum planes, pointing inwards
+    vec4 planes[6];
+    for( int i = 0; i < 3; ++i ) {
+        vec4 row(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+        planes[i * 2] = w + row;
+        planes[i * 2 + 1] = w - row;
+    }
+
+    int candidates[MAX_BATCH];
+    batchSize = 0;
+    for( int i = 0; i < numLights; ++i ) {
+        if( !lights[i].stale || !isInView(planes, lights[i].position) )
+            continue;
+
+        // Keep the budget's worth that were redrawn longest ago
+        int slot = batchSize;
+        while( slot > 0 && lights[candidates[slot - 1]].lastUpdate > lights[i].lastUpdate ) {
+            if( slot < budget )
+                candidates[slot] = candidates[slot - 1];
+            --slot;
+        }
+        if( slot < budget ) {
+            candidates[slot] = i;
+            batchSize = min(batchSize + 1, budget);
+        }
+    }
+
+    for( int k = 0; k < batchSize; ++k ) {
+        Light & light = lights[candidates[k]];
+        light.stale = false;
+        light.lastUpdate = frame;
+        batch[k] = vec4(light.position, (float)(candidates[k] * 6));
+    }
+    return batchSize;
+}
+
+// Whether any of the light's range is inside the frustum
+bool PointShadowMap::isInView( const vec4 * planes, const vec3 & position )
+{
+    for( int i = 0; i < 6; ++i ) {
+        float distance = glm::dot(vec3(planes[i]), position) + planes[i].w;
+        if( distance < -farPlane * glm::length(vec3(planes[i])) )
+            return false;
+    }
+    return true;
+}
+
+void PointShadowMap::begin()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, resolution, resolution);
+
+    // Only the faces about to be drawn are cleared, the rest keep their shadows
+    for( int k = 0; k < batchSize; ++k ) {
+        for( int face = 0; face < 6; ++face ) {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0,
+                                      (GLint)batch[k].w + face);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+    }
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0);
+}
+
+void PointShadowMap::bindTexture( GLuint unit )
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, depthTexture);
+}
+
+int PointShadowMap::getNumLights()
+{
+    return numLights;
+}
+
+float PointShadowMap::getFarPlane()
+{
+    return farPlane;
+}
+
+const mat4 * PointShadowMap::getFaceMatrices()
+{
+    return faceMatrices;
+}
+
+const vec4 * PointShadowMap::getBatch()
+{
+    return batch;
+}
+
+int PointShadowMap::getBatchSize()
+{
+    return batchSize;
+}
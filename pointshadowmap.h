@@ -0,0 +1,90 @@
+#ifndef POINTSHADOWMAP_H
+#define POINTSHADOWMAP_H
+
+#include "cookbookogl.h"
+
+#include <glm/glm.hpp>
+using glm::vec3;
+using glm::vec4;
+using glm::mat4;
+
+#include <vector>
+
+// Omnidirectional shadows for a set of point lights, kept in one cube map
+// array with six layers per light. Each layer stores the distance to the
+// light divided by the far plane, so receivers can compare against it
+// with hardware filtering (samplerCubeArrayShadow).
+//
+// The lights to redraw are drawn together in one layered pass: a geometry
+// shader sends each triangle to every face of every light in the batch.
+// Lights only take part when they are marked stale and their range is in
+// view, and at most the update budget of them per frame, the ones redrawn
+// longest ago first, so the cost stays flat as lights are added.
+class PointShadowMap
+{
+  public:
+    // Lights one pass can draw, bounded by the geometry shader invocations
+    static const int MAX_BATCH = 4;
+
+  private:
+    GLuint fbo;
+    GLuint depthTexture;
+    int numLights;
+    GLsizei resolution;
+    float farPlane;
+    int budget;
+    int frame;
+
+    mat4 faceMatrices[6];       // Projection * view of each face, light at the origin
+
+    struct Light {
+        vec3 position;
+        bool stale;
+        int lastUpdate;         // Frame of the last redraw, -1 before the first
+    };
+    std::vector<Light> lights;
+
+    // Lights drawn by this frame's pass: xyz position, w the layer of face 0
+    vec4 batch[MAX_BATCH];
+    int batchSize;
+
+    bool   isInView( const vec4 * planes, const vec3 & position );
+
+    // Non-copyable
+    PointShadowMap( const PointShadowMap & other ) { }
+    PointShadowMap & operator=( const PointShadowMap &other ) { return *this; }
+
+  public:
+    PointShadowMap();
+    ~PointShadowMap();
+
+    void   create( int numLights, GLsizei resolution = 256, float farPlane = 15.0f );
+
+    // Lights redrawn per frame at most, up to MAX_BATCH
+    void   setUpdateBudget( int lights );
+
+    // Marks the light stale when it moved
+    void   setLightPosition( int light, const vec3 & position );
+    // Call when casters in a light's range are added, removed or moved
+    void   invalidate( int light );
+    void   invalidateAll();
+
+    // Picks the lights to redraw this frame and counts them as up to date.
+    // Returns how many there are, 0 when the pass can be skipped.
+    int    schedule( const mat4 & viewProjection );
+
+    // Clears the scheduled lights' faces and binds the whole array as a
+    // layered target with a matching viewport. The caller restores its own
+    // framebuffer afterwards.
+    void   begin();
+
+    void   bindTexture( GLuint unit );
+
+    int    getNumLights();
+    float  getFarPlane();
+    const mat4 * getFaceMatrices();
+    const vec4 * getBatch();
+    int    getBatchSize();
+};
+
+#endif // POINTSHADOWMAP_H
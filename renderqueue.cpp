@@ -0,0 +1,164 @@
+#include "renderqueue.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace {
+    // Key fields. GL names are small integers, so their low bits tell
+    // programs and vertex arrays apart; a clash only costs a state change.
+    const int LAYER_SHIFT = 62;
+    const int DEPTH_BITS = 24;
+    const int PROGRAM_BITS = 12;
+    const int MATERIAL_BITS = 12;
+    const int VAO_BITS = 14;
+
+    inline uint64_t field( uint64_t value, int bits )
+    {
+        return value & ((uint64_t(1) << bits) - 1);
+    }
+}
+
+RenderQueue::RenderQueue() : farPlane(100.0f), draws(0), stateChanges(0)
+{
+}
+
+void RenderQueue::begin( const mat4 & view, float farPlane )
+{
+    this->view = view;
+    this->farPlane = farPlane;
+}
+
+void RenderQueue::submit( const DrawItem & item, Layer layer )
+{
+    keys.push_back(makeKey(item, layer));
+    order.push_back((GLuint)items.size());
+    items.push_back(item);
+}
+
+uint64_t RenderQueue::makeKey( const DrawItem & item, Layer layer )
+{
+    float distance = -(view * item.model[3]).z;
+    float scaled = glm::clamp(distance / farPlane, 0.0f, 1.0f) * float((1 << DEPTH_BITS) - 1);
+    uint64_t depth = (uint64_t)scaled;
+
+    uint64_t state = field(item.program->getHandle(), PROGRAM_BITS);
+    state = (state << MATERIAL_BITS) | field(item.material, MATERIAL_BITS);
+    state = (state << VAO_BITS) | field(item.vao, VAO_BITS);
+
+    uint64_t key = (uint64_t)layer << LAYER_SHIFT;
+    if( layer == SOLID )
+        return key | (state << DEPTH_BITS) | depth;
+
+    // Farthest first
+    depth = ((uint64_t(1) << DEPTH_BITS) - 1) - depth;
+    return key | (depth << (LAYER_SHIFT - DEPTH_BITS)) | state;
+}
+
+// LSD radix sort of the keys a byte at a time, carrying the item order
+// along. Bytes that are the same in every key are skipped, which with few
+// programs and materials is most of them.
+void RenderQueue::sort()
+{
+    size_t count = keys.size();
+    sortedKeys.resize(count);
+    sortedOrder.resize(count);
+
+    GLuint histograms[8][256];
+    memset(histograms, 0, sizeof(histograms));
+    for( size_t i = 0; i < count; ++i )
+        for( int byte = 0; byte < 8; ++byte )
+            histograms[byte][(keys[i] >> (byte * 8)) & 0xFF]++;
+
+    for( int byte = 0; byte < 8; ++byte ) {
+        GLuint * histogram = histograms[byte];
+        if( histogram[(keys[0] >> (byte * 8)) & 0xFF] == count )
+            continue;
+
+        GLuint offset = 0;
+        for( int digit = 0; digit < 256; ++digit ) {
+            GLuint n = histogram[digit];
+            histogram[digit] = offset;
+            offset += n;
+        }
+
+        for( size_t i = 0; i < count; ++i ) {
+            GLuint slot = histogram[(keys[i] >> (byte * 8)) & 0xFF]++;
+            sortedKeys[slot] = keys[i];
+            sortedOrder[slot] = order[i];
+        }
+        keys.swap(sortedKeys);
+        order.swap(sortedOrder);
+    }
+}
+
+void RenderQueue::flush()
+{
+    draws = 0;
+    stateChanges = 0;
+    if( items.empty() )
+        return;
+
+    sort();
+
+    GLSLProgram * program = NULL;
+    GLuint vao = 0;
+    bool vaoBound = false;
+    // Uniforms last set on the current program by this flush
+    bool modelSet = false, materialSet = false;
+    mat4 model;
+    GLuint material = 0;
+
+    for( size_t i = 0; i < order.size(); ++i ) {
+        const DrawItem & item = items[order[i]];
+
+        if( item.program != program ) {
+            item.program->use();
+            program = item.program;
+            modelSet = materialSet = false;
+            ++stateChanges;
+        }
+        if( !vaoBound || item.vao != vao ) {
+            glBindVertexArray(item.vao);
+            vao = item.vao;
+            vaoBound = true;
+            ++stateChanges;
+        }
+        if( item.modelUniform.location >= 0 && (!modelSet || item.model != model) ) {
+            program->setUniform(item.modelUniform, item.model);
+            model = item.model;
+            modelSet = true;
+            ++stateChanges;
+        }
+        if( item.materialUniform.location >= 0 && (!materialSet || item.material != material) ) {
+            program->setUniform(item.materialUniform, item.material);
+            material = item.material;
+            materialSet = true;
+            ++stateChanges;
+        }
+
+        if( item.instances == 1 && item.baseInstance == 0 )
+            glDrawElements(GL_TRIANGLES, item.count, item.indexType, 0);
+        else if( item.baseInstance == 0 )
+            glDrawElementsInstanced(GL_TRIANGLES, item.count, item.indexType, 0, item.instances);
+        else
+            glDrawElementsInstancedBaseInstance(GL_TRIANGLES, item.count, item.indexType, 0,
+                                                item.instances, item.baseInstance);
+        ++draws;
+    }
+    glBindVertexArray(0);
+
+    items.clear();
+    keys.clear();
+    order.clear();
+}
+
+int RenderQueue::getDraws()
+{
+    return draws;
+}
+
+int RenderQueue::getStateChanges()
+{
+    return stateChanges;
+}
@@ -0,0 +1,88 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include "cookbookogl.h"
+#include "glslprogram.h"
+
+#include <glm/glm.hpp>
+using glm::mat4;
+
+#include <cstdint>
+#include <vector>
+
+// One indexed triangle draw: the program, the vertex array and what the
+// program needs set per draw. Textures come from the MaterialLibrary, so
+// the material index is the only material state.
+struct DrawItem
+{
+    GLSLProgram * program;
+    GLuint vao;
+    GLenum indexType;
+    GLsizei count;
+    GLsizei instances;
+    GLuint baseInstance;
+
+    GLSLUniform modelUniform;
+    mat4 model;
+    GLSLUniform materialUniform;    // Left invalid when the program sets its own
+    GLuint material;
+
+    DrawItem( GLSLProgram & program, GLuint vao, GLenum indexType, GLsizei count ) :
+        program(&program), vao(vao), indexType(indexType), count(count), instances(1),
+        baseInstance(0), material(0) { }
+};
+
+// Collects a frame's draws and issues them in state order. Each draw gets
+// a 64-bit key; the keys are radix sorted and the draws submitted in key
+// order, skipping program, vertex array and uniform changes that would
+// set what is already current.
+//
+// Solid draws sort by program, then material, then vertex array, and
+// front to back among draws with the same state, so early depth testing
+// rejects what is hidden. Blended draws sort back to front first, as
+// blending needs, and by state among draws at the same depth.
+class RenderQueue
+{
+  public:
+    enum Layer {
+        SOLID = 0,
+        BLENDED = 1
+    };
+
+  private:
+    std::vector<DrawItem> items;
+    std::vector<uint64_t> keys, sortedKeys;
+    std::vector<GLuint> order, sortedOrder;
+
+    mat4 view;
+    float farPlane;
+
+    int draws;
+    int stateChanges;
+
+    uint64_t makeKey( const DrawItem & item, Layer layer );
+    void   sort();
+
+    // Non-copyable
+    RenderQueue( const RenderQueue & other ) { }
+    RenderQueue & operator=( const RenderQueue &other ) { return *this; }
+
+  public:
+    RenderQueue();
+
+    // Depths are measured along view, out to farPlane. Call once a frame.
+    void   begin( const mat4 & view, float farPlane );
+
+    // The draw's depth is that of its model matrix's origin
+    void   submit( const DrawItem & item, Layer layer = SOLID );
+
+    // Sorts and issues the queued draws, then empties the queue
+    void   flush();
+
+    // Of the last flush: draws issued, and program, vertex array and
+    // uniform changes made for them
+    int    getDraws();
+    int    getStateChanges();
+};
+
+#endif // RENDERQUEUE_H
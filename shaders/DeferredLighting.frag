@@ -0,0 +1,245 @@
+#version 430 core
+// Lighting pass of the deferred path, once per covered pixel. G-buffer:
+//   gDiffuse   RGBA8     diffuse colour, a ambient / diffuse ratio / 4
+//   gSpecular  RGBA8     specular colour, a log2(shininess) / 8
+//   gNormal    RGB10_A2  octahedral normal, b 1 to gamma correct, a flags / 3
+//   gDepth     depth, the world position is rebuilt from it
+
+// Permutation switches, set by GLSLProgram::setDefines
+#ifndef GAMMA
+#define GAMMA 1
+#endif
+#ifndef NUM_CASCADES
+#define NUM_CASCADES 4
+#endif
+#ifndef PCF_RADIUS
+#define PCF_RADIUS 1
+#endif
+
+out vec4 FragColor;
+
+struct DirLight {
+    vec3 direction;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+layout (std140) uniform Lights {
+    PointLight pointLight;
+};
+
+// Point lights binned into froxels by LightClusters.comp
+struct PointLightData {
+    vec4 position;      // xyz world position, w range
+    vec4 color;         // rgb scale of pointLight's colours
+};
+
+layout (std430, binding = 1) readonly buffer PointLights {
+    uint numLights;
+    PointLightData lights[];
+};
+
+layout (std430, binding = 2) readonly buffer ClusterGrid {
+    uvec4 clusterCount;
+    vec4 clusterScale;      // xy froxels per pixel, z slice scale, w slice bias
+    uvec2 clusters[];       // Offset into lightIndices, count
+};
+
+layout (std430, binding = 3) readonly buffer LightIndices {
+    uint lightIndices[];
+};
+
+// Units are fixed here so the program validates before anything is set
+layout (binding = 0) uniform sampler2D gDiffuse;
+layout (binding = 1) uniform sampler2D gSpecular;
+layout (binding = 2) uniform sampler2D gNormal;
+layout (binding = 3) uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+
+uniform DirLight dirLight;
+
+// Cascaded shadow map, one layer per slice of the view frustum
+layout (binding = 4) uniform sampler2DArray shadowMap;
+uniform mat4 lightSpaceMatrices[NUM_CASCADES];
+uniform float cascadeSplits[NUM_CASCADES];
+uniform float cascadeBias[NUM_CASCADES];
+uniform vec3 shadowLightDir;
+
+layout (binding = 5) uniform samplerCubeArrayShadow pointShadowMap;
+uniform int numPointShadows;
+uniform float pointShadowFar;
+
+const int SHADOWED = 1;
+const int DIR_LIT = 2;
+
+// Surface of this pixel
+vec3 FragPos;
+vec3 normal;
+vec3 diffuseColor;
+vec3 ambientColor;
+vec3 specularColor;
+float shininess;
+float fragShadow;
+
+vec3 decodeNormal(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if(n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+    return normalize(n);
+}
+
+vec3 dirLightCalc(vec3 viewDir)
+{
+    vec3 lightDir = normalize(-dirLight.direction);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+
+    return dirLight.ambient * ambientColor + dirLight.diffuse * diff * diffuseColor +
+           dirLight.specular * spec * specularColor;
+}
+
+float PointShadowCalculation(int lightIndex, vec3 lightDir)
+{
+    if(lightIndex >= numPointShadows)
+        return 0.0;
+
+    vec3 fragToLight = FragPos - lights[lightIndex].position.xyz;
+    float distance = length(fragToLight);
+    if(distance > pointShadowFar)
+        return 0.0;
+
+    float texel = 2.0 * distance / float(textureSize(pointShadowMap, 0).x);
+    float bias = texel * mix(1.5, 4.0, 1.0 - max(dot(normal, lightDir), 0.0));
+    float reference = (distance - bias) / pointShadowFar;
+
+    return 1.0 - texture(pointShadowMap, vec4(fragToLight, float(lightIndex)), reference);
+}
+
+vec3 pointLightCalc(int lightIndex, vec3 viewDir, bool shadowed)
+{
+    vec3 lightDir = normalize(lights[lightIndex].position.xyz - FragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+
+    vec3 ambient = pointLight.ambient * ambientColor;
+    vec3 diffuse = diff * pointLight.diffuse * diffuseColor;
+    vec3 specular = pointLight.specular * spec * specularColor;
+
+    float distance    = length(lights[lightIndex].position.xyz - FragPos);
+    float attenuation = 1.0f / (pointLight.constant + pointLight.linear * distance +
+                        pointLight.quadratic * (distance * distance));
+    float falloff = clamp(1.0 - pow(distance / lights[lightIndex].position.w, 4.0), 0.0, 1.0);
+    vec3 lightScale = lights[lightIndex].color.rgb * attenuation * falloff * falloff;
+
+    float shadow = shadowed ? max(fragShadow, PointShadowCalculation(lightIndex, lightDir)) : 0.0;
+
+    return lightScale * (ambient + (1.0 - shadow) * (diffuse + specular));
+}
+
+float ShadowCalculation()
+{
+    float depth = -(view * vec4(FragPos, 1.0)).z;
+    int layer = -1;
+    for(int i = 0; i < NUM_CASCADES; ++i)
+    {
+        if(depth < cascadeSplits[i])
+        {
+            layer = i;
+            break;
+        }
+    }
+    if(layer < 0)
+        return 0.0;
+
+    vec4 fragPosLightSpace = lightSpaceMatrices[layer] * vec4(FragPos, 1.0);
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    projCoords = projCoords * 0.5 + 0.5;
+    if(projCoords.z > 1.0)
+        return 0.0;
+
+    vec3 lightDir = normalize(-shadowLightDir);
+    float bias = cascadeBias[layer] * mix(1.0, 5.0, 1.0 - max(dot(normal, lightDir), 0.0));
+    float shadow = 0.0;
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    for(int x = -PCF_RADIUS; x <= PCF_RADIUS; ++x)
+    {
+        for(int y = -PCF_RADIUS; y <= PCF_RADIUS; ++y)
+        {
+            float pcfDepth = texture(shadowMap, vec3(projCoords.xy + vec2(x, y) * texelSize, layer)).r;
+            shadow += projCoords.z - bias > pcfDepth ? 1.0 : 0.0;
+        }
+    }
+    return shadow / float((2 * PCF_RADIUS + 1) * (2 * PCF_RADIUS + 1));
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    // Nothing was drawn here, keep the clear colour
+    if(depth >= 1.0)
+        discard;
+    gl_FragDepth = depth;
+
+    vec2 uv = (vec2(pixel) + 0.5) / vec2(textureSize(gDepth, 0));
+    vec4 world = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    FragPos = world.xyz / world.w;
+
+    vec4 diffuseSample = texelFetch(gDiffuse, pixel, 0);
+    vec4 specularSample = texelFetch(gSpecular, pixel, 0);
+    vec4 normalSample = texelFetch(gNormal, pixel, 0);
+    diffuseColor = diffuseSample.rgb;
+    ambientColor = diffuseSample.rgb * diffuseSample.a * 4.0;
+    specularColor = specularSample.rgb;
+    shininess = exp2(specularSample.a * 8.0);
+    normal = decodeNormal(normalSample.rg);
+    int flags = int(normalSample.a * 3.0 + 0.5);
+
+    bool shadowed = (flags & SHADOWED) != 0;
+    fragShadow = shadowed ? ShadowCalculation() : 0.0;
+
+    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 color = vec3(0.0);
+
+    if((flags & DIR_LIT) != 0)
+        color += dirLightCalc(viewDir);
+
+    // Only the lights binned into this pixel's froxel
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+    uvec3 froxel = uvec3(uvec2(gl_FragCoord.xy * clusterScale.xy),
+                         uint(max(log(viewDepth) * clusterScale.z + clusterScale.w, 0.0)));
+    froxel = min(froxel, clusterCount.xyz - 1u);
+    uvec2 cluster = clusters[froxel.x + clusterCount.x * (froxel.y + clusterCount.y * froxel.z)];
+    for (uint k = 0u; k < cluster.y; k++)
+    {
+        color += pointLightCalc(int(lightIndices[cluster.x + k]), viewDir, shadowed);
+    }
+
+#if GAMMA
+    if(normalSample.b > 0.5)
+        color = pow(color, vec3(1.0/2.2));
+#endif
+
+    FragColor = vec4(color, 1.0f);
+}
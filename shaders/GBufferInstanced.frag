@@ -0,0 +1,49 @@
+#version 430 core
+// Geometry pass for the instanced diamonds, material from the table
+
+// The forward diamond program has no gamma correction, so by default
+// neither does the lighting pass for these pixels
+#ifndef GAMMA
+#define GAMMA 0
+#endif
+
+layout (location = 0) out vec4 gDiffuse;
+layout (location = 1) out vec4 gSpecular;
+layout (location = 2) out vec4 gNormal;
+
+in vec3 Normal;
+in vec3 FragPos;
+flat in uint MaterialIndex;
+
+// specular.w holds the shininess
+struct MaterialBlock {
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+};
+
+layout (std430, binding = 0) readonly buffer Materials {
+    MaterialBlock materials[];
+};
+
+uniform int flags;      // 1 shadowed, 2 lit by dirLight
+
+vec2 encodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * sign(n.xy);
+    return e * 0.5 + 0.5;
+}
+
+void main()
+{
+    MaterialBlock block = materials[MaterialIndex];
+
+    // The ambient colour is kept as its brightness relative to the diffuse
+    const vec3 luma = vec3(0.2126, 0.7152, 0.0722);
+    float ambientRatio = dot(block.ambient.rgb, luma) / max(dot(block.diffuse.rgb, luma), 1e-4);
+
+    gDiffuse = vec4(block.diffuse.rgb, ambientRatio / 4.0);
+    gSpecular = vec4(block.specular.rgb, log2(max(block.specular.w, 1.0)) / 8.0);
+    gNormal = vec4(encodeNormal(normalize(Normal)), float(GAMMA), float(flags) / 3.0);
+}
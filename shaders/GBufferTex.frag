@@ -0,0 +1,64 @@
+#version 430 core
+// Geometry pass for the textured surfaces: writes the material instead of
+// lighting it. See DeferredLighting.frag for the layout.
+
+// Whether the lighting pass gamma corrects these surfaces, as the forward
+// path's textured programs do
+#ifndef GAMMA
+#define GAMMA 1
+#endif
+
+layout (location = 0) out vec4 gDiffuse;
+layout (location = 1) out vec4 gSpecular;
+layout (location = 2) out vec4 gNormal;
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoords;
+
+// Textured materials from MaterialLibrary. Each texture is a layer of one
+// of the array pages bound from unit 8 on; a page past the last means the
+// texture hasn't been copied in yet.
+const int MAX_MATERIAL_PAGES = 8;
+
+struct TexturedMaterial {
+    uvec4 layers;       // diffuse page, diffuse layer, specular page, specular layer
+    vec4 params;        // shininess, diffuse strength, specular strength, surface flags
+};
+
+layout (std430, binding = 4) readonly buffer TexturedMaterials {
+    TexturedMaterial texturedMaterials[];
+};
+
+uniform sampler2DArray materialPages[MAX_MATERIAL_PAGES];
+uniform uint materialIndex;
+
+// The page is the same for the whole draw, as indexing a sampler array needs
+vec3 samplePage(uint page, uint layer)
+{
+    if(page >= uint(MAX_MATERIAL_PAGES))
+        return vec3(0.5);
+    return texture(materialPages[page], vec3(TexCoords, float(layer))).rgb;
+}
+
+// Octahedral mapping of a unit vector to [0,1]^2
+vec2 encodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * sign(n.xy);
+    return e * 0.5 + 0.5;
+}
+
+void main()
+{
+    TexturedMaterial material = texturedMaterials[materialIndex];
+    vec3 texel = samplePage(material.layers.x, material.layers.y);
+    float diffuseStrength = material.params.y;
+
+    // Ambient is the unscaled texture, kept as a ratio to the diffuse colour
+    gDiffuse = vec4(diffuseStrength * texel, 0.25 / diffuseStrength);
+    gSpecular = vec4(material.params.z * samplePage(material.layers.z, material.layers.w),
+                     log2(max(material.params.x, 1.0)) / 8.0);
+    // Flags 1 shadowed, 2 lit by dirLight
+    gNormal = vec4(encodeNormal(normalize(Normal)), float(GAMMA), material.params.w / 3.0);
+}
@@ -1,8 +1,21 @@
 #version 430 core
+
+// Permutation switches, set by GLSLProgram::setDefines
+#ifndef NUM_DIRS
+#define NUM_DIRS 0
+#endif
+#ifndef NUM_SPOTS
+#define NUM_SPOTS 0
+#endif
+#ifndef GAMMA
+#define GAMMA 0
+#endif
+
 out vec4 FragColor;
 
 in vec3 Normal;
 in vec3 FragPos;
+flat in uint MaterialIndex;
 
 struct Material {
     vec3 ambient;
@@ -11,6 +24,18 @@ struct Material {
     float shininess;
 };
 
+// One entry per material, indexed by the instance's material index.
+// specular.w holds the shininess.
+struct MaterialBlock {
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+};
+
+layout (std430, binding = 0) readonly buffer Materials {
+    MaterialBlock materials[];
+};
+
 struct DirLight {
     vec3 direction;
     vec3 ambient;
@@ -42,17 +67,41 @@ struct PointLight {
     vec3 specular;
 };
 
-uniform vec3 viewPos;
-uniform int numDirs;
-uniform int numSpots;
-uniform int numPoints;
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+layout (std140) uniform Lights {
+    PointLight pointLight;
+};
+
+// Point lights binned into froxels by LightClusters.comp
+struct PointLightData {
+    vec4 position;      // xyz world position, w range
+    vec4 color;         // rgb scale of pointLight's colours
+};
+
+layout (std430, binding = 1) readonly buffer PointLights {
+    uint numLights;
+    PointLightData lights[];
+};
+
+layout (std430, binding = 2) readonly buffer ClusterGrid {
+    uvec4 clusterCount;
+    vec4 clusterScale;      // xy froxels per pixel, z slice scale, w slice bias
+    uvec2 clusters[];       // Offset into lightIndices, count
+};
+
+layout (std430, binding = 3) readonly buffer LightIndices {
+    uint lightIndices[];
+};
+
 uniform vec3 spotLightPos[10];
-uniform vec3 pointLightPos[10];
-uniform Material material;
+Material material;
 uniform DirLight dirLight;
 uniform SpotLight spotLight;
-uniform PointLight pointLight;
-uniform bool gamma;
 
 vec3 dirLightCalc(int lightIndex, vec3 viewDir, vec3 normal);
 vec3 spotLightCalc(int lightIndex, vec3 viewDir, vec3 normal);
@@ -60,28 +109,41 @@ vec3 pointLightCalc(int lightIndex, vec3 viewDir, vec3 normal);
 
 void main()
 {
+    MaterialBlock block = materials[MaterialIndex];
+    material.ambient = block.ambient.rgb;
+    material.diffuse = block.diffuse.rgb;
+    material.specular = block.specular.rgb;
+    material.shininess = block.specular.w;
+
     vec3 color = vec3(0.0);
 
     vec3 normal = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
 
-    for (int i = 0; i < numDirs; i++)
+    for (int i = 0; i < NUM_DIRS; i++)
     {
         color += dirLightCalc(i, viewDir, normal);
     }
 
-    for (int i = 0; i < numSpots; i++)
+    for (int i = 0; i < NUM_SPOTS; i++)
     {
         color += spotLightCalc(i, viewDir, normal);
     }
 
-    for (int i = 0; i < numPoints; i++)
+    // Only the lights binned into this fragment's froxel
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+    uvec3 froxel = uvec3(uvec2(gl_FragCoord.xy * clusterScale.xy),
+                         uint(max(log(viewDepth) * clusterScale.z + clusterScale.w, 0.0)));
+    froxel = min(froxel, clusterCount.xyz - 1u);
+    uvec2 cluster = clusters[froxel.x + clusterCount.x * (froxel.y + clusterCount.y * froxel.z)];
+    for (uint k = 0u; k < cluster.y; k++)
     {
-        color += pointLightCalc(i, viewDir, normal);
+        color += pointLightCalc(int(lightIndices[cluster.x + k]), viewDir, normal);
     }
 
-    if(gamma)
-        color = pow(color, vec3(1.0/2.2));
+#if GAMMA
+    color = pow(color, vec3(1.0/2.2));
+#endif
 
     FragColor = vec4(color, 1.0f);
 }
@@ -146,7 +208,7 @@ vec3 pointLightCalc(int lightIndex, vec3 viewDir, vec3 normal)
     vec3 ambient = pointLight.ambient * material.ambient;
 
     // Diffuse
-    vec3 lightDir = normalize(pointLightPos[lightIndex] - FragPos);
+    vec3 lightDir = normalize(lights[lightIndex].position.xyz - FragPos);
     float diff = max(dot(lightDir, normal), 0.0);
     vec3 diffuse = diff * pointLight.diffuse * material.diffuse;
 
@@ -159,13 +221,17 @@ vec3 pointLightCalc(int lightIndex, vec3 viewDir, vec3 normal)
     vec3 specular = pointLight.specular * material.specular * spec;
 
     // Attenuation
-    float distance    = length(pointLightPos[lightIndex] - FragPos);
+    float distance    = length(lights[lightIndex].position.xyz - FragPos);
     float attenuation = 1.0f / (pointLight.constant + pointLight.linear * distance +
                         pointLight.quadratic * (distance * distance));
 
-    ambient  *= attenuation;
-    diffuse  *= attenuation;
-    specular *= attenuation;
+    // Fades out at the light's range, where the clustering cuts it off
+    float falloff = clamp(1.0 - pow(distance / lights[lightIndex].position.w, 4.0), 0.0, 1.0);
+    vec3 lightScale = lights[lightIndex].color.rgb * attenuation * falloff * falloff;
+
+    ambient  *= lightScale;
+    diffuse  *= lightScale;
+    specular *= lightScale;
 
     return(ambient + diffuse + specular);
 }
@@ -0,0 +1,26 @@
+#version 430 core
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 3) in mat4 instanceModel;
+layout (location = 7) in uint instanceMaterial;
+
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+uniform mat4 model;     // Applied to every instance before instanceModel
+
+out vec3 Normal;
+out vec3 FragPos;
+flat out uint MaterialIndex;
+
+void main()
+{
+    mat4 world = instanceModel * model;
+    gl_Position = projection * view * world * vec4(position, 1.0f);
+    FragPos = vec3(world * vec4(position, 1.0f));
+    Normal = mat3(transpose(inverse(world))) * normal;
+    MaterialIndex = instanceMaterial;
+}
@@ -1,4 +1,26 @@
 #version 430 core
+
+// Permutation switches, set by GLSLProgram::setDefines after the #version
+// line. Counts are compile time constants so the loops unroll.
+#ifndef NUM_DIRS
+#define NUM_DIRS 0
+#endif
+#ifndef NUM_SPOTS
+#define NUM_SPOTS 0
+#endif
+#ifndef GAMMA
+#define GAMMA 1
+#endif
+#ifndef SHADOWS
+#define SHADOWS 0
+#endif
+#ifndef NUM_CASCADES
+#define NUM_CASCADES 4
+#endif
+#ifndef PCF_RADIUS
+#define PCF_RADIUS 1
+#endif
+
 out vec4 FragColor;
 
 in vec3 Normal;
@@ -6,9 +28,12 @@ in vec3 FragPos;
 in vec2 TexCoords;
 
 struct Material {
-    sampler2D diffuse;
-    sampler2D specular;
+    vec3 diffuse;
+    vec3 specular;
     float shininess;
+    // How strongly the surface responds to the shared light colours
+    float diffuseStrength;
+    float specularStrength;
 };
 
 struct DirLight {
@@ -42,48 +67,136 @@ struct PointLight {
     vec3 specular;
 };
 
-uniform vec3 viewPos;
-uniform int numDirs;
-uniform int numSpots;
-uniform int numPoints;
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+layout (std140) uniform Lights {
+    PointLight pointLight;
+};
+
+// Point lights binned into froxels by LightClusters.comp
+struct PointLightData {
+    vec4 position;      // xyz world position, w range
+    vec4 color;         // rgb scale of pointLight's colours
+};
+
+layout (std430, binding = 1) readonly buffer PointLights {
+    uint numLights;
+    PointLightData lights[];
+};
+
+layout (std430, binding = 2) readonly buffer ClusterGrid {
+    uvec4 clusterCount;
+    vec4 clusterScale;      // xy froxels per pixel, z slice scale, w slice bias
+    uvec2 clusters[];       // Offset into lightIndices, count
+};
+
+layout (std430, binding = 3) readonly buffer LightIndices {
+    uint lightIndices[];
+};
+
+// Textured materials from MaterialLibrary. Each texture is a layer of one
+// of the array pages bound from unit 8 on; a page past the last means the
+// texture hasn't been copied in yet.
+const int MAX_MATERIAL_PAGES = 8;
+
+struct TexturedMaterial {
+    uvec4 layers;       // diffuse page, diffuse layer, specular page, specular layer
+    vec4 params;        // shininess, diffuse strength, specular strength, surface flags
+};
+
+layout (std430, binding = 4) readonly buffer TexturedMaterials {
+    TexturedMaterial texturedMaterials[];
+};
+
+uniform sampler2DArray materialPages[MAX_MATERIAL_PAGES];
+uniform uint materialIndex;
+
+// The page is the same for the whole draw, as indexing a sampler array needs
+vec3 samplePage(uint page, uint layer)
+{
+    if(page >= uint(MAX_MATERIAL_PAGES))
+        return vec3(0.5);
+    return texture(materialPages[page], vec3(TexCoords, float(layer))).rgb;
+}
+
 uniform vec3 spotLightPos[10];
-uniform vec3 pointLightPos[10];
-uniform Material material;
+Material material;
 uniform DirLight dirLight;
 uniform SpotLight spotLight;
-uniform PointLight pointLight;
 uniform sampler2D objTexture;
-uniform bool gamma;
+
+#if SHADOWS
+// Cascaded shadow map, one layer per slice of the view frustum
+uniform sampler2DArray shadowMap;
+uniform mat4 lightSpaceMatrices[NUM_CASCADES];
+uniform float cascadeSplits[NUM_CASCADES];  // View space far distance of each slice
+uniform float cascadeBias[NUM_CASCADES];    // Depth bias of each layer
+uniform vec3 shadowLightDir;                // Direction the shadow casting light shines in
+
+// Point light shadows, six cube map array layers per light holding the
+// distance to the light over pointShadowFar
+uniform samplerCubeArrayShadow pointShadowMap;
+uniform int numPointShadows;                // Lights from lights[0] that have one
+uniform float pointShadowFar;
+#endif
 
 vec3 dirLightCalc(int lightIndex, vec3 viewDir, vec3 normal);
 vec3 spotLightCalc(int lightIndex, vec3 viewDir, vec3 normal);
 vec3 pointLightCalc(int lightIndex, vec3 viewDir, vec3 normal);
+#if SHADOWS
+float ShadowCalculation();
+float PointShadowCalculation(int lightIndex, vec3 normal, vec3 lightDir);
+#endif
+
+// The same for every light, so it is looked up once per fragment
+float fragShadow = 0.0;
 
 void main()
 {
+    // Sampled once here instead of in every light
+    TexturedMaterial entry = texturedMaterials[materialIndex];
+    material.diffuse = samplePage(entry.layers.x, entry.layers.y);
+    material.specular = samplePage(entry.layers.z, entry.layers.w);
+    material.shininess = entry.params.x;
+    material.diffuseStrength = entry.params.y;
+    material.specularStrength = entry.params.z;
 
     vec3 color = vec3(0.0);
 
     vec3 normal = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
+#if SHADOWS
+    fragShadow = ShadowCalculation();
+#endif
 
-    for (int i = 0; i < numDirs; i++)
+    for (int i = 0; i < NUM_DIRS; i++)
     {
         color += dirLightCalc(i, viewDir, normal);
     }
 
-    for (int i = 0; i < numSpots; i++)
+    for (int i = 0; i < NUM_SPOTS; i++)
     {
         color += spotLightCalc(i, viewDir, normal);
     }
 
-    for (int i = 0; i < numPoints; i++)
+    // Only the lights binned into this fragment's froxel
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+    uvec3 froxel = uvec3(uvec2(gl_FragCoord.xy * clusterScale.xy),
+                         uint(max(log(viewDepth) * clusterScale.z + clusterScale.w, 0.0)));
+    froxel = min(froxel, clusterCount.xyz - 1u);
+    uvec2 cluster = clusters[froxel.x + clusterCount.x * (froxel.y + clusterCount.y * froxel.z)];
+    for (uint k = 0u; k < cluster.y; k++)
     {
-        color += pointLightCalc(i, viewDir, normal);
+        color += pointLightCalc(int(lightIndices[cluster.x + k]), viewDir, normal);
     }
 
-    if(gamma)
-        color = pow(color, vec3(1.0/2.2));
+#if GAMMA
+    color = pow(color, vec3(1.0/2.2));
+#endif
 
     FragColor = vec4(color, 1.0f);
 
@@ -98,22 +211,24 @@ vec3 dirLightCalc(int lightIndex, vec3 viewDir, vec3 normal)
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // Combine results
-    vec3 ambient = dirLight.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = dirLight.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = dirLight.specular * spec * vec3(texture(material.specular, TexCoords));
-    return (ambient + diffuse + specular);
+    vec3 ambient = dirLight.ambient * material.diffuse;
+    vec3 diffuse = material.diffuseStrength * dirLight.diffuse * diff * material.diffuse;
+    vec3 specular = material.specularStrength * dirLight.specular * spec * material.specular;
+
+    vec3 lighting = (ambient + (1.0 - fragShadow) * (diffuse + specular));
+    return(lighting);
 }
 
 
 vec3 spotLightCalc(int lightIndex, vec3 viewDir, vec3 normal)
 {
 
-    vec3 ambient = spotLight.ambient * vec3(texture(material.diffuse, TexCoords));
+    vec3 ambient = spotLight.ambient * material.diffuse;
 
     // Diffuse
     vec3 lightDir = normalize(spotLightPos[lightIndex] - FragPos);
     float diff = max(dot(normal, lightDir), 0.0);
-    vec3 diffuse = diff * spotLight.diffuse * vec3(texture(material.diffuse, TexCoords));
+    vec3 diffuse = material.diffuseStrength * diff * spotLight.diffuse * material.diffuse;
 
     // Specular
     vec3 reflectDir = reflect(-lightDir, normal);
@@ -121,7 +236,7 @@ vec3 spotLightCalc(int lightIndex, vec3 viewDir, vec3 normal)
 
     vec3 halfwayDir = normalize(lightDir + viewDir);
     spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-    vec3 specular = spotLight.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 specular = material.specularStrength * spotLight.specular * spec * material.specular;
 
 
     // Spotlight (soft edges)
@@ -140,19 +255,20 @@ vec3 spotLightCalc(int lightIndex, vec3 viewDir, vec3 normal)
     diffuse  *= attenuation;
     specular *= attenuation;
 
-    return(ambient + diffuse + specular);
+    vec3 lighting = (ambient + (1.0 - fragShadow) * (diffuse + specular));
+    return(lighting);
 
 }
 
 vec3 pointLightCalc(int lightIndex, vec3 viewDir, vec3 normal)
 {
 
-    vec3 ambient = pointLight.ambient * vec3(texture(material.diffuse, TexCoords));
+    vec3 ambient = pointLight.ambient * material.diffuse;
 
     // Diffuse
-    vec3 lightDir = normalize(pointLightPos[lightIndex] - FragPos);
+    vec3 lightDir = normalize(lights[lightIndex].position.xyz - FragPos);
     float diff = max(dot(normal, lightDir), 0.0);
-    vec3 diffuse = diff * pointLight.diffuse * vec3(texture(material.diffuse, TexCoords));
+    vec3 diffuse = material.diffuseStrength * diff * pointLight.diffuse * material.diffuse;
 
     // Specular
     vec3 reflectDir = reflect(-lightDir, normal);
@@ -160,18 +276,96 @@ vec3 pointLightCalc(int lightIndex, vec3 viewDir, vec3 normal)
 
     vec3 halfwayDir = normalize(lightDir + viewDir);
     spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-    vec3 specular = pointLight.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 specular = material.specularStrength * pointLight.specular * spec * material.specular;
 
     // Attenuation
-    float distance    = length(pointLightPos[lightIndex] - FragPos);
+    float distance    = length(lights[lightIndex].position.xyz - FragPos);
     float attenuation = 1.0f / (pointLight.constant + pointLight.linear * distance +
                         pointLight.quadratic * (distance * distance));
 
-    ambient  *= attenuation;
-    diffuse  *= attenuation;
-    specular *= attenuation;
+    // Fades out at the light's range, where the clustering cuts it off
+    float falloff = clamp(1.0 - pow(distance / lights[lightIndex].position.w, 4.0), 0.0, 1.0);
+    vec3 lightScale = lights[lightIndex].color.rgb * attenuation * falloff * falloff;
+
+    ambient  *= lightScale;
+    diffuse  *= lightScale;
+    specular *= lightScale;
 
-    return(ambient + diffuse + specular);
+    // The cascades stay as the shared overhead term, each lamp adds its own
+    float shadow = fragShadow;
+#if SHADOWS
+    shadow = max(shadow, PointShadowCalculation(lightIndex, normal, lightDir));
+#endif
 
+    vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular));
+    return(lighting);
 }
 
+#if SHADOWS
+float PointShadowCalculation(int lightIndex, vec3 normal, vec3 lightDir)
+{
+    if(lightIndex >= numPointShadows)
+        return 0.0;
+
+    vec3 fragToLight = FragPos - lights[lightIndex].position.xyz;
+    float distance = length(fragToLight);
+    if(distance > pointShadowFar)
+        return 0.0;
+
+    // A texel covers about 2 * distance / resolution at this distance
+    float texel = 2.0 * distance / float(textureSize(pointShadowMap, 0).x);
+    float bias = texel * mix(1.5, 4.0, 1.0 - max(dot(normal, lightDir), 0.0));
+    float reference = (distance - bias) / pointShadowFar;
+
+    // Filtered comparison, 1.0 where lit
+    return 1.0 - texture(pointShadowMap, vec4(fragToLight, float(lightIndex)), reference);
+}
+
+float ShadowCalculation()
+{
+    // Pick the cascade covering this fragment's view depth
+    float depth = -(view * vec4(FragPos, 1.0)).z;
+    int layer = -1;
+    for(int i = 0; i < NUM_CASCADES; ++i)
+    {
+        if(depth < cascadeSplits[i])
+        {
+            layer = i;
+            break;
+        }
+    }
+    // Beyond the shadow distance
+    if(layer < 0)
+        return 0.0;
+
+    vec4 fragPosLightSpace = lightSpaceMatrices[layer] * vec4(FragPos, 1.0);
+    // perform perspective divide
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    // Transform to [0,1] range
+    projCoords = projCoords * 0.5 + 0.5;
+    // Get depth of current fragment from light's perspective
+    float currentDepth = projCoords.z;
+    // Calculate bias (based on the cascade's texel size and slope)
+    vec3 normal = normalize(Normal);
+    vec3 lightDir = normalize(-shadowLightDir);
+    float bias = cascadeBias[layer] * mix(1.0, 5.0, 1.0 - max(dot(normal, lightDir), 0.0));
+    // PCF
+    float shadow = 0.0;
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    for(int x = -PCF_RADIUS; x <= PCF_RADIUS; ++x)
+    {
+        for(int y = -PCF_RADIUS; y <= PCF_RADIUS; ++y)
+        {
+            float pcfDepth = texture(shadowMap, vec3(projCoords.xy + vec2(x, y) * texelSize, layer)).r;
+            shadow += currentDepth - bias > pcfDepth  ? 1.0 : 0.0;
+        }
+    }
+    shadow /= float((2 * PCF_RADIUS + 1) * (2 * PCF_RADIUS + 1));
+
+    // Keep the shadow at 0.0 when outside the far_plane region of the light's frustum.
+    if(projCoords.z > 1.0)
+        shadow = 0.0;
+
+    return shadow;
+}
+#endif
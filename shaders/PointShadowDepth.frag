@@ -0,0 +1,11 @@
+#version 430 core
+in vec3 FragPos;
+flat in vec3 LightPos;
+
+uniform float farPlane;
+
+void main()
+{
+    // Linear distance, so every face compares the same way
+    gl_FragDepth = length(FragPos - LightPos) / farPlane;
+}
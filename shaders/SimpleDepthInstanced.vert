@@ -0,0 +1,11 @@
+#version 430 core
+layout (location = 0) in vec3 position;
+layout (location = 3) in mat4 instanceModel;
+
+uniform mat4 lightSpaceMatrix;
+uniform mat4 model;     // Applied to every instance before instanceModel
+
+void main()
+{
+    gl_Position = lightSpaceMatrix * instanceModel * model * vec4(position, 1.0f);
+}
@@ -7,9 +7,13 @@ layout (location = 2) in vec2 texCoords;
 
 out vec2 TexCoords;
 
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main()
 {
@@ -3,9 +3,11 @@ layout (location = 0) in vec4 vertex; // <vec2 pos, vec2 tex>
 out vec2 TexCoords;
 
 uniform mat4 projection;
+uniform vec2 offset;    // Position of the string's origin on screen
+uniform sampler2D text; // Glyph atlas, texture coordinates come in texels
 
 void main()
 {
-    gl_Position = projection * vec4(vertex.xy, 0.0, 1.0);
-    TexCoords = vertex.zw;
+    gl_Position = projection * vec4(vertex.xy + offset, 0.0, 1.0);
+    TexCoords = vertex.zw / vec2(textureSize(text, 0));
 }
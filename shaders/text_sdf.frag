@@ -0,0 +1,16 @@
+#version 430 core
+in vec2 TexCoords;
+out vec4 color;
+
+// Signed distance field atlas, 0.5 on the glyph outline
+uniform sampler2D text;
+uniform vec3 textColor;
+
+void main()
+{
+    float distance = texture(text, TexCoords).r;
+    // Antialias over one screen pixel whatever the scale the glyph is drawn at
+    float width = fwidth(distance);
+    float alpha = smoothstep(0.5 - width, 0.5 + width, distance);
+    color = vec4(textColor, alpha);
+}
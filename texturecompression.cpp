@@ -0,0 +1,348 @@
+#include "texturecompression.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+namespace {
+    const unsigned char KTX_IDENTIFIER[12] = {
+        0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+    };
+    const GLuint KTX_ENDIANNESS = 0x04030201;
+
+    struct KTXHeader {
+        unsigned char identifier[12];
+        GLuint endianness;
+        GLuint glType, glTypeSize, glFormat;
+        GLuint glInternalFormat, glBaseInternalFormat;
+        GLuint pixelWidth, pixelHeight, pixelDepth;
+        GLuint numberOfArrayElements, numberOfFaces, numberOfMipmapLevels;
+        GLuint bytesOfKeyValueData;
+    };
+
+    // Linear and sRGB format pairs
+    const GLenum FORMAT_PAIRS[][2] = {
+        {GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT},
+        {GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT},
+        {GL_COMPRESSED_RGBA_BPTC_UNORM, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM},
+        {GL_COMPRESSED_RGB8_ETC2, GL_COMPRESSED_SRGB8_ETC2},
+        {GL_COMPRESSED_RGBA8_ETC2_EAC, GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC}
+    };
+    const size_t NUM_FORMAT_PAIRS = sizeof(FORMAT_PAIRS) / sizeof(FORMAT_PAIRS[0]);
+
+    // Numbers the temporary files, so loader threads writing the same
+    // sidecar at once each write their own
+    atomic<unsigned> tempCounter(0);
+
+    float srgbToLinear( unsigned char value )
+    {
+        float c = value / 255.0f;
+        return c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    unsigned char linearToSRGB( float c )
+    {
+        c = c <= 0.0031308f ? c * 12.92f : 1.055f * pow(c, 1.0f / 2.4f) - 0.055f;
+        return (unsigned char)min(255.0f, max(0.0f, c * 255.0f + 0.5f));
+    }
+
+    // Halves an RGB8 image with a 2x2 box filter, clamping at odd edges
+    void downsample( const vector<unsigned char> & src, int width, int height, bool sRGB,
+                     const float * toLinear, vector<unsigned char> & dst )
+    {
+        int w = max(1, width / 2), h = max(1, height / 2);
+        dst.resize(w * h * 3);
+        for( int y = 0; y < h; ++y ) {
+            int y0 = min(2 * y, height - 1), y1 = min(2 * y + 1, height - 1);
+            for( int x = 0; x < w; ++x ) {
+                int x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+                for( int c = 0; c < 3; ++c ) {
+                    unsigned char a = src[(y0 * width + x0) * 3 + c];
+                    unsigned char b = src[(y0 * width + x1) * 3 + c];
+                    unsigned char d = src[(y1 * width + x0) * 3 + c];
+                    unsigned char e = src[(y1 * width + x1) * 3 + c];
+                    if( sRGB ) {
+                        float sum = toLinear[a] + toLinear[b] + toLinear[d] + toLinear[e];
+                        dst[(y * w + x) * 3 + c] = linearToSRGB(sum * 0.25f);
+                    } else
+                        dst[(y * w + x) * 3 + c] = (unsigned char)((a + b + d + e + 2) / 4);
+                }
+            }
+        }
+    }
+
+    GLushort to565( const int * rgb )
+    {
+        return (GLushort)(((rgb[0] * 31 + 127) / 255) << 11 |
+                          ((rgb[1] * 63 + 127) / 255) << 5 |
+                          ((rgb[2] * 31 + 127) / 255));
+    }
+
+    void from565( GLushort c, int * rgb )
+    {
+        int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+
+    // Bounding box BC1 encoder (van Waveren, "Real-Time DXT Compression"),
+    // with the box diagonal flipped per channel to follow the colour trend
+    void encodeBlock( const unsigned char block[16][3], unsigned char * out )
+    {
+        int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+        float mean[3] = {0.0f, 0.0f, 0.0f};
+        for( int i = 0; i < 16; ++i ) {
+            for( int c = 0; c < 3; ++c ) {
+                lo[c] = min(lo[c], (int)block[i][c]);
+                hi[c] = max(hi[c], (int)block[i][c]);
+                mean[c] += block[i][c] / 16.0f;
+            }
+        }
+
+        // Red and blue against green: anti-correlated channels run the
+        // other way along the diagonal
+        float covRG = 0.0f, covBG = 0.0f;
+        for( int i = 0; i < 16; ++i ) {
+            float g = block[i][1] - mean[1];
+            covRG += (block[i][0] - mean[0]) * g;
+            covBG += (block[i][2] - mean[2]) * g;
+        }
+
+        // Inset the box a little, the extremes are usually outliers
+        int e0[3], e1[3];
+        for( int c = 0; c < 3; ++c ) {
+            int inset = (hi[c] - lo[c]) / 16;
+            e0[c] = hi[c] - inset;
+            e1[c] = lo[c] + inset;
+        }
+        if( covRG < 0.0f ) swap(e0[0], e1[0]);
+        if( covBG < 0.0f ) swap(e0[2], e1[2]);
+
+        GLushort c0 = to565(e0), c1 = to565(e1);
+        GLuint indices = 0;
+
+        if( c0 != c1 ) {
+            // c0 > c1 selects the four colour mode
+            if( c0 < c1 ) swap(c0, c1);
+
+            int palette[4][3];
+            from565(c0, palette[0]);
+            from565(c1, palette[1]);
+            for( int c = 0; c < 3; ++c ) {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+
+            for( int i = 0; i < 16; ++i ) {
+                int best = 0, bestDist = INT_MAX;
+                for( int p = 0; p < 4; ++p ) {
+                    int dr = block[i][0] - palette[p][0];
+                    int dg = block[i][1] - palette[p][1];
+                    int db = block[i][2] - palette[p][2];
+                    int dist = dr * dr + dg * dg + db * db;
+                    if( dist < bestDist ) {
+                        bestDist = dist;
+                        best = p;
+                    }
+                }
+                indices |= (GLuint)best << (2 * i);
+            }
+        }
+
+        // Little endian: two 565 endpoints, then 2 bits per texel
+        out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+        out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+        for( int i = 0; i < 4; ++i )
+            out[4 + i] = (indices >> (8 * i)) & 0xFF;
+    }
+
+    void encodeLevel( const vector<unsigned char> & rgb, int width, int height,
+                      unsigned char * out )
+    {
+        unsigned char block[16][3];
+        for( int by = 0; by < height; by += 4 ) {
+            for( int bx = 0; bx < width; bx += 4 ) {
+                // Partial blocks at the edges repeat the last row/column
+                for( int y = 0; y < 4; ++y ) {
+                    for( int x = 0; x < 4; ++x ) {
+                        int sx = min(bx + x, width - 1), sy = min(by + y, height - 1);
+                        memcpy(block[y * 4 + x], &rgb[(sy * width + sx) * 3], 3);
+                    }
+                }
+                encodeBlock(block, out);
+                out += 8;
+            }
+        }
+    }
+}
+
+GLsizei TextureCompression::blockSize( GLenum internalFormat )
+{
+    switch( internalFormat ) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGB8_ETC2:
+        case GL_COMPRESSED_SRGB8_ETC2:
+            return 8;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_RG_RGTC2:
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+        case GL_COMPRESSED_RGBA8_ETC2_EAC:
+        case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+GLenum TextureCompression::withSRGB( GLenum internalFormat, bool sRGB )
+{
+    for( size_t i = 0; i < NUM_FORMAT_PAIRS; ++i ) {
+        if( FORMAT_PAIRS[i][0] == internalFormat || FORMAT_PAIRS[i][1] == internalFormat )
+            return FORMAT_PAIRS[i][sRGB ? 1 : 0];
+    }
+    return internalFormat;
+}
+
+void TextureCompression::encodeBC1( const unsigned char * rgb, int width, int height, bool sRGB,
+                                    CompressedImage & image )
+{
+    float toLinear[256];
+    for( int i = 0; i < 256; ++i )
+        toLinear[i] = srgbToLinear((unsigned char)i);
+
+    image.internalFormat = sRGB ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+                                : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    image.levels.clear();
+    image.data.clear();
+
+    vector<unsigned char> level(rgb, rgb + (size_t)width * height * 3), next;
+    for( ;; ) {
+        CompressedLevel info;
+        info.width = width;
+        info.height = height;
+        info.offset = image.data.size();
+        info.size = (size_t)((width + 3) / 4) * ((height + 3) / 4) * 8;
+        image.levels.push_back(info);
+
+        image.data.resize(info.offset + info.size);
+        encodeLevel(level, width, height, &image.data[info.offset]);
+
+        if( width == 1 && height == 1 )
+            break;
+        downsample(level, width, height, sRGB, toLinear, next);
+        level.swap(next);
+        width = max(1, width / 2);
+        height = max(1, height / 2);
+    }
+}
+
+bool TextureCompression::readKTX( const string & path, CompressedImage & image )
+{
+    ifstream in(path.c_str(), ios::in | ios::binary);
+    if( !in )
+        return false;
+
+    KTXHeader header;
+    if( !in.read((char *)&header, sizeof(header)) ||
+        memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 ||
+        header.endianness != KTX_ENDIANNESS )
+        return false;
+
+    // Only plain 2D compressed images: no arrays, cube maps or 3D
+    GLsizei block = blockSize(header.glInternalFormat);
+    if( header.glType != 0 || block == 0 || header.pixelWidth == 0 ||
+        header.pixelDepth > 1 || header.numberOfArrayElements > 0 ||
+        header.numberOfFaces != 1 )
+        return false;
+
+    in.seekg(header.bytesOfKeyValueData, ios::cur);
+
+    image.internalFormat = header.glInternalFormat;
+    image.levels.clear();
+    image.data.clear();
+
+    GLuint numLevels = max(1u, header.numberOfMipmapLevels);
+    int width = header.pixelWidth, height = max(1u, header.pixelHeight);
+    for( GLuint i = 0; i < numLevels; ++i ) {
+        GLuint imageSize;
+        if( !in.read((char *)&imageSize, sizeof(imageSize)) )
+            return false;
+
+        CompressedLevel info;
+        info.width = width;
+        info.height = height;
+        info.offset = image.data.size();
+        info.size = (size_t)((width + 3) / 4) * ((height + 3) / 4) * block;
+        if( imageSize != info.size )
+            return false;
+
+        image.data.resize(info.offset + info.size);
+        if( !in.read((char *)&image.data[info.offset], info.size) )
+            return false;
+        image.levels.push_back(info);
+
+        // Levels are padded to 4 bytes, which blocks already are
+        width = max(1, width / 2);
+        height = max(1, height / 2);
+    }
+    return true;
+}
+
+bool TextureCompression::writeKTX( const string & path, const CompressedImage & image )
+{
+    if( image.levels.empty() )
+        return false;
+
+    KTXHeader header;
+    memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+    header.endianness = KTX_ENDIANNESS;
+    header.glType = 0;
+    header.glTypeSize = 1;
+    header.glFormat = 0;
+    header.glInternalFormat = image.internalFormat;
+    header.glBaseInternalFormat = blockSize(image.internalFormat) == 8 ? GL_RGB : GL_RGBA;
+    header.pixelWidth = image.levels[0].width;
+    header.pixelHeight = image.levels[0].height;
+    header.pixelDepth = 0;
+    header.numberOfArrayElements = 0;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = (GLuint)image.levels.size();
+    header.bytesOfKeyValueData = 0;
+
+    // Through a temporary file so a reader never sees half a sidecar
+    string tempPath = path + "." + to_string(tempCounter++) + ".tmp";
+    {
+        ofstream out(tempPath.c_str(), ios::out | ios::binary | ios::trunc);
+        if( !out )
+            return false;
+
+        out.write((const char *)&header, sizeof(header));
+        for( size_t i = 0; i < image.levels.size(); ++i ) {
+            GLuint imageSize = (GLuint)image.levels[i].size;
+            out.write((const char *)&imageSize, sizeof(imageSize));
+            out.write((const char *)&image.data[image.levels[i].offset], imageSize);
+        }
+        if( !out ) {
+            out.close();
+            remove(tempPath.c_str());
+            return false;
+        }
+    }
+
+    remove(path.c_str());
+    if( rename(tempPath.c_str(), path.c_str()) != 0 ) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
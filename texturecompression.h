@@ -0,0 +1,52 @@
+#ifndef TEXTURECOMPRESSION_H
+#define TEXTURECOMPRESSION_H
+
+#include "cookbookogl.h"
+
+#include <string>
+using std::string;
+#include <vector>
+
+// S3TC/BPTC/ETC2 enums not in the 4.3 core loader
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT        0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT       0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT       0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// One mip level of a compressed image, as an offset into its data
+struct CompressedLevel {
+    int width, height;
+    size_t offset, size;
+};
+
+// A block-compressed 2D texture with its full mip chain
+struct CompressedImage {
+    GLenum internalFormat;
+    std::vector<CompressedLevel> levels;
+    std::vector<unsigned char> data;
+};
+
+namespace TextureCompression
+{
+    // Bytes per 4x4 block, 0 for formats we don't handle: BC1, BC3, BC5,
+    // BC7 and ETC2 RGB/RGBA, each with its sRGB variant where there is one
+    GLsizei blockSize( GLenum internalFormat );
+
+    // Maps a format to its sRGB or linear twin, or returns it unchanged
+    GLenum withSRGB( GLenum internalFormat, bool sRGB );
+
+    // Builds the mip chain of an RGB8 image (averaging in linear space for
+    // sRGB data) and encodes every level as BC1
+    void encodeBC1( const unsigned char * rgb, int width, int height, bool sRGB,
+        CompressedImage & image );
+
+    // KTX 1.1 container for 2D compressed images
+    bool readKTX( const string & path, CompressedImage & image );
+    bool writeKTX( const string & path, const CompressedImage & image );
+}
+
+#endif // TEXTURECOMPRESSION_H
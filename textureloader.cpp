@@ -0,0 +1,470 @@
+#include "textureloader.h"
+
+#include <SOIL.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <cstdio>
+#include <iostream>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace {
+    // Unpack buffers kept around for reuse once the GPU is done with them
+    const size_t MAX_FREE_BUFFERS = 4;
+
+    // Unreferenced textures kept by default
+    const GLsizeiptr DEFAULT_CACHE_BUDGET = 64 * 1024 * 1024;
+
+    bool hasExtension( const char * name )
+    {
+        GLint numExtensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+        for( GLint i = 0; i < numExtensions; ++i ) {
+            const char * ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+            if( ext != NULL && strcmp(ext, name) == 0 )
+                return true;
+        }
+        return false;
+    }
+
+    bool endsWith( const string & str, const char * suffix )
+    {
+        size_t length = strlen(suffix);
+        return str.size() >= length && str.compare(str.size() - length, length, suffix) == 0;
+    }
+
+    // A sidecar is fresh when it is at least as new as its source
+    bool isFresh( const string & sidecar, const string & source )
+    {
+        struct stat sidecarInfo, sourceInfo;
+        if( stat(sidecar.c_str(), &sidecarInfo) != 0 )
+            return false;
+        if( stat(source.c_str(), &sourceInfo) != 0 )
+            return true;
+        return sidecarInfo.st_mtime >= sourceInfo.st_mtime;
+    }
+}
+
+TextureLoader * TextureLoader::shared = NULL;
+
+TextureLoader::TextureLoader( unsigned int numThreads ) :
+    outstanding(0), stopping(false), unusedBytes(0), cacheBudget(DEFAULT_CACHE_BUDGET)
+{
+    compressionSupported = hasExtension("GL_EXT_texture_compression_s3tc");
+    compression = compressionSupported;
+
+    if( numThreads == 0 )
+        numThreads = thread::hardware_concurrency();
+    if( numThreads == 0 )
+        numThreads = 1;
+
+    for( unsigned int i = 0; i < numThreads; ++i )
+        workers.push_back(thread(&TextureLoader::workerLoop, this));
+}
+
+TextureLoader::~TextureLoader()
+{
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for( size_t i = 0; i < workers.size(); ++i )
+        workers[i].join();
+
+    for( size_t i = 0; i < queued.size(); ++i )
+        delete queued[i];
+    for( size_t i = 0; i < decoded.size(); ++i ) {
+        if( decoded[i]->pixels != NULL )
+            SOIL_free_image_data(decoded[i]->pixels);
+        delete decoded[i];
+    }
+
+    recycleBuffers(true);
+    for( size_t i = 0; i < inFlight.size(); ++i ) {
+        glDeleteSync(inFlight[i].fence);
+        glDeleteBuffers(1, &inFlight[i].buffer);
+    }
+    for( size_t i = 0; i < freeBuffers.size(); ++i )
+        glDeleteBuffers(1, &freeBuffers[i].buffer);
+
+    if( shared == this )
+        shared = NULL;
+}
+
+GLuint TextureLoader::load( const string & path, bool sRGB, bool mipmaps, GLenum wrap )
+{
+    string key = cacheKey(path, sRGB, mipmaps, wrap);
+    unordered_map<string, CacheEntry>::iterator found = cache.find(key);
+    if( found != cache.end() ) {
+        CacheEntry & entry = found->second;
+        if( entry.refs++ == 0 ) {
+            unused.erase(entry.unusedPos);
+            unusedBytes -= entry.bytes;
+        }
+        return entry.texture;
+    }
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+
+    // Mid grey until the real image arrives
+    const GLubyte placeholder[4] = {128, 128, 128, 255};
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, sRGB ? GL_SRGB : GL_RGB, 1, 1, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, placeholder);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                     mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    if( mipmaps )
+        glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    CacheEntry entry;
+    entry.texture = texture;
+    entry.refs = 1;
+    entry.uploaded = false;
+    entry.bytes = 0;
+    entry.unusedPos = unused.end();
+    cache[key] = entry;
+    textureKeys[texture] = key;
+
+    Job * job = new Job();
+    job->texture = texture;
+    job->path = path;
+    job->sRGB = sRGB;
+    job->mipmaps = mipmaps;
+    job->compress = compression;
+    job->state = QUEUED;
+    job->width = job->height = 0;
+    job->pixels = NULL;
+    job->isCompressed = false;
+
+    {
+        lock_guard<mutex> lock(queueMutex);
+        queued.push_back(job);
+        ++outstanding;
+    }
+    workAvailable.notify_one();
+
+    return texture;
+}
+
+void TextureLoader::workerLoop()
+{
+    unique_lock<mutex> lock(queueMutex);
+    for( ;; ) {
+        while( !stopping && queued.empty() )
+            workAvailable.wait(lock);
+        if( stopping )
+            return;
+
+        Job * job = queued.front();
+        queued.pop_front();
+
+        // Decode without holding the lock, this is the expensive part
+        lock.unlock();
+        decode(job);
+        lock.lock();
+
+        decoded.push_back(job);
+        jobDecoded.notify_all();
+    }
+}
+
+void TextureLoader::update()
+{
+    recycleBuffers(false);
+
+    deque<Job *> ready;
+    {
+        lock_guard<mutex> lock(queueMutex);
+        ready.swap(decoded);
+    }
+
+    for( size_t i = 0; i < ready.size(); ++i ) {
+        upload(ready[i]);
+        delete ready[i];
+    }
+
+    if( !ready.empty() ) {
+        lock_guard<mutex> lock(queueMutex);
+        outstanding -= (int)ready.size();
+    }
+}
+
+void TextureLoader::finish()
+{
+    for( ;; ) {
+        update();
+
+        unique_lock<mutex> lock(queueMutex);
+        if( outstanding == 0 )
+            return;
+        while( decoded.empty() )
+            jobDecoded.wait(lock);
+    }
+}
+
+// Runs on a worker thread, so no GL calls in here
+void TextureLoader::decode( Job * job )
+{
+    if( endsWith(job->path, ".ktx") ) {
+        job->isCompressed = TextureCompression::readKTX(job->path, job->compressed);
+        job->state = job->isCompressed ? DECODED : FAILED;
+        return;
+    }
+
+    string sidecar = job->path + (job->sRGB ? ".srgb.ktx" : ".ktx");
+    if( job->compress && isFresh(sidecar, job->path) &&
+        TextureCompression::readKTX(sidecar, job->compressed) ) {
+        job->isCompressed = true;
+        job->state = DECODED;
+        return;
+    }
+
+    job->pixels = SOIL_load_image(job->path.c_str(), &job->width, &job->height, 0,
+                                  SOIL_LOAD_RGB);
+    if( job->pixels == NULL ) {
+        job->state = FAILED;
+        return;
+    }
+    job->state = DECODED;
+
+    if( job->compress ) {
+        TextureCompression::encodeBC1(job->pixels, job->width, job->height, job->sRGB,
+                                      job->compressed);
+        SOIL_free_image_data(job->pixels);
+        job->pixels = NULL;
+        job->isCompressed = true;
+
+        if( !TextureCompression::writeKTX(sidecar, job->compressed) )
+            cerr << "Unable to write compressed texture: " << sidecar << endl;
+    }
+}
+
+int TextureLoader::getPending()
+{
+    lock_guard<mutex> lock(queueMutex);
+    return outstanding;
+}
+
+void TextureLoader::upload( Job * job )
+{
+    CacheEntry & entry = cache[textureKeys[job->texture]];
+    entry.uploaded = true;
+
+    if( job->state == FAILED ) {
+        cerr << "Unable to load texture: " << job->path << endl;
+        return;
+    }
+
+    if( job->isCompressed ) {
+        uploadCompressed(job, entry);
+        return;
+    }
+
+    GLsizeiptr size = (GLsizeiptr)job->width * job->height * 3;
+    Upload upload = acquireBuffer(size);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer);
+    void * dest = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    memcpy(dest, job->pixels, size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    SOIL_free_image_data(job->pixels);
+    job->pixels = NULL;
+
+    // The copy out of the buffer happens on the GPU timeline, but in command
+    // order, so the texture can be drawn with straight away
+    glBindTexture(GL_TEXTURE_2D, job->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);   // RGB rows aren't 4 byte aligned
+    glTexImage2D(GL_TEXTURE_2D, 0, job->sRGB ? GL_SRGB : GL_RGB, job->width, job->height, 0,
+                 GL_RGB, GL_UNSIGNED_BYTE, (GLvoid *)0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if( job->mipmaps )
+        glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // The buffer can be refilled once the GPU has read it
+    upload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    inFlight.push_back(upload);
+
+    // Drivers store RGB8 as four bytes a texel; a mip chain adds a third
+    entry.bytes = (GLsizeiptr)job->width * job->height * 4;
+    if( job->mipmaps )
+        entry.bytes += entry.bytes / 3;
+
+    // Released before it even arrived
+    if( entry.refs == 0 ) {
+        unusedBytes += entry.bytes;
+        trimCache();
+    }
+}
+
+void TextureLoader::release( GLuint texture )
+{
+    unordered_map<GLuint, string>::iterator key = textureKeys.find(texture);
+    if( key == textureKeys.end() )
+        return;
+
+    CacheEntry & entry = cache[key->second];
+    if( --entry.refs > 0 )
+        return;
+
+    unused.push_front(key->second);
+    entry.unusedPos = unused.begin();
+    unusedBytes += entry.bytes;
+    trimCache();
+}
+
+bool TextureLoader::isLoaded( GLuint texture )
+{
+    unordered_map<GLuint, string>::iterator key = textureKeys.find(texture);
+    return key == textureKeys.end() || cache[key->second].uploaded;
+}
+
+void TextureLoader::setCacheBudget( GLsizeiptr bytes )
+{
+    cacheBudget = bytes;
+    trimCache();
+}
+
+void TextureLoader::trimCache()
+{
+    // Least recently released first, skipping textures a worker is still decoding
+    list<string>::iterator it = unused.end();
+    while( unusedBytes > cacheBudget && it != unused.begin() ) {
+        --it;
+        CacheEntry & entry = cache[*it];
+        if( !entry.uploaded )
+            continue;
+
+        glDeleteTextures(1, &entry.texture);
+        unusedBytes -= entry.bytes;
+        textureKeys.erase(entry.texture);
+        string key = *it;
+        it = unused.erase(it);
+        cache.erase(key);
+    }
+}
+
+string TextureLoader::cacheKey( const string & path, bool sRGB, bool mipmaps, GLenum wrap )
+{
+    // Different spellings of the same file share an entry
+    string canonical = path;
+#ifdef _WIN32
+    char resolved[_MAX_PATH];
+    if( _fullpath(resolved, path.c_str(), _MAX_PATH) != NULL )
+        canonical = resolved;
+#else
+    char resolved[PATH_MAX];
+    if( realpath(path.c_str(), resolved) != NULL )
+        canonical = resolved;
+#endif
+
+    char params[64];
+    snprintf(params, sizeof(params), "|srgb=%d|mip=%d|wrap=%04x", sRGB ? 1 : 0,
+             mipmaps ? 1 : 0, wrap);
+    return canonical + params;
+}
+
+void TextureLoader::uploadCompressed( Job * job, CacheEntry & entry )
+{
+    CompressedImage & image = job->compressed;
+    GLenum format = TextureCompression::withSRGB(image.internalFormat, job->sRGB);
+    GLuint numLevels = job->mipmaps ? (GLuint)image.levels.size() : 1;
+    GLsizeiptr size = image.levels[numLevels - 1].offset + image.levels[numLevels - 1].size;
+
+    // Blocks go to the driver exactly as stored
+    Upload upload = acquireBuffer(size);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer);
+    void * dest = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    memcpy(dest, &image.data[0], size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glBindTexture(GL_TEXTURE_2D, job->texture);
+    for( GLuint i = 0; i < numLevels; ++i ) {
+        const CompressedLevel & level = image.levels[i];
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, format, level.width, level.height, 0,
+                               (GLsizei)level.size, (GLvoid *)level.offset);
+    }
+    // A KTX file may stop short of 1x1
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    upload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    inFlight.push_back(upload);
+
+    entry.bytes = size;
+    if( entry.refs == 0 ) {
+        unusedBytes += entry.bytes;
+        trimCache();
+    }
+}
+
+TextureLoader::Upload TextureLoader::acquireBuffer( GLsizeiptr size )
+{
+    for( size_t i = 0; i < freeBuffers.size(); ++i ) {
+        if( freeBuffers[i].size >= size ) {
+            Upload upload = freeBuffers[i];
+            freeBuffers.erase(freeBuffers.begin() + i);
+            return upload;
+        }
+    }
+
+    Upload upload = {0, size, 0};
+    glGenBuffers(1, &upload.buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return upload;
+}
+
+void TextureLoader::recycleBuffers( bool wait )
+{
+    for( size_t i = 0; i < inFlight.size(); ) {
+        GLenum status = glClientWaitSync(inFlight[i].fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                         wait ? 1000000000 : 0);
+        if( status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED ) {
+            glDeleteSync(inFlight[i].fence);
+            inFlight[i].fence = 0;
+
+            if( freeBuffers.size() < MAX_FREE_BUFFERS )
+                freeBuffers.push_back(inFlight[i]);
+            else
+                glDeleteBuffers(1, &inFlight[i].buffer);
+
+            inFlight.erase(inFlight.begin() + i);
+        } else
+            ++i;
+    }
+}
+
+void TextureLoader::setCompression( bool enabled )
+{
+    compression = enabled && compressionSupported;
+}
+
+bool TextureLoader::isCompressionSupported()
+{
+    return compressionSupported;
+}
+
+void TextureLoader::setShared( TextureLoader * loader )
+{
+    shared = loader;
+}
+
+TextureLoader * TextureLoader::getShared()
+{
+    return shared;
+}
@@ -0,0 +1,139 @@
+#ifndef TEXTURELOADER_H
+#define TEXTURELOADER_H
+
+#include "cookbookogl.h"
+#include "texturecompression.h"
+
+#include <string>
+using std::string;
+#include <vector>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Loads 2D textures in the background. load() returns a texture name at
+// once; the texture holds a 1x1 placeholder until a worker thread has
+// decoded the file and update() has uploaded it. Uploads go through pixel
+// unpack buffers that are recycled once their fence has signalled.
+//
+// Where the driver supports S3TC, images are stored as BC1. The first load
+// of a file encodes it on the worker and writes a KTX sidecar next to it
+// (path + ".ktx", or ".srgb.ktx"); later loads read the sidecar and upload
+// it as is. Files that are KTX already (BC1/3/5/7, ETC2) are loaded directly.
+//
+// Textures are shared process-wide: loading the same file with the same
+// parameters again returns the same texture and bumps its reference count.
+// release() drops a reference; unreferenced textures stay cached, and so
+// can be picked up again for free, until they exceed the cache budget.
+//
+// Everything except the worker threads runs on the thread that owns the
+// GL context, so the cache itself needs no locking.
+class TextureLoader
+{
+  private:
+    enum JobState { QUEUED, DECODED, FAILED };
+
+    struct Job {
+        GLuint texture;
+        string path;
+        bool sRGB;
+        bool mipmaps;
+        bool compress;
+        JobState state;
+        int width, height;
+        unsigned char * pixels;
+        bool isCompressed;
+        CompressedImage compressed;
+    };
+
+    struct Upload {
+        GLuint buffer;
+        GLsizeiptr size;
+        GLsync fence;
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex queueMutex;
+    std::condition_variable workAvailable;
+    std::condition_variable jobDecoded;
+    std::deque<Job *> queued;       // Waiting for a worker
+    std::deque<Job *> decoded;      // Waiting for update() to upload them
+    int outstanding;                // Loaded but not uploaded yet
+    bool stopping;
+
+    std::vector<Upload> inFlight;   // Unpack buffers the GPU may still read
+    std::vector<Upload> freeBuffers;
+
+    struct CacheEntry {
+        GLuint texture;
+        int refs;
+        bool uploaded;              // Never evicted while a worker still owns the job
+        GLsizeiptr bytes;           // Estimated GPU size including mipmaps
+        std::list<string>::iterator unusedPos;
+    };
+
+    // Keyed by canonical path plus load parameters
+    std::unordered_map<string, CacheEntry> cache;
+    std::unordered_map<GLuint, string> textureKeys;
+    std::list<string> unused;       // Unreferenced entries, most recently released first
+    GLsizeiptr unusedBytes;
+    GLsizeiptr cacheBudget;
+
+    bool compressionSupported;      // GL_EXT_texture_compression_s3tc
+    bool compression;
+
+    static TextureLoader * shared;
+
+    void   workerLoop();
+    void   decode( Job * job );
+    void   uploadCompressed( Job * job, CacheEntry & entry );
+    void   upload( Job * job );
+    Upload acquireBuffer( GLsizeiptr size );
+    void   recycleBuffers( bool wait );
+
+    string cacheKey( const string & path, bool sRGB, bool mipmaps, GLenum wrap );
+    void   trimCache();
+
+    // Non-copyable
+    TextureLoader( const TextureLoader & other ) { }
+    TextureLoader & operator=( const TextureLoader &other ) { return *this; }
+
+  public:
+    // numThreads 0 uses one worker per hardware thread
+    TextureLoader( unsigned int numThreads = 0 );
+    ~TextureLoader();
+
+    GLuint load( const string & path, bool sRGB = false, bool mipmaps = true,
+                 GLenum wrap = GL_REPEAT );
+    void   release( GLuint texture );
+
+    // Whether the texture holds its image rather than the placeholder,
+    // true for textures that didn't come from this loader
+    bool   isLoaded( GLuint texture );
+
+    // Bytes of unreferenced textures to keep around, 0 evicts them at once
+    void   setCacheBudget( GLsizeiptr bytes );
+
+    // BC1 compression of new loads, on by default where supported
+    void   setCompression( bool enabled );
+    bool   isCompressionSupported();
+
+    // Uploads what the workers have decoded since the last call. Call once a frame.
+    void   update();
+
+    // Blocks until every texture requested so far is uploaded
+    void   finish();
+
+    // Number of textures still showing their placeholder
+    int    getPending();
+
+    // Loader used by code that has no loader of its own (Model's
+    // TextureFromFile). NULL means load synchronously.
+    static void setShared( TextureLoader * loader );
+    static TextureLoader * getShared();
+};
+
+#endif // TEXTURELOADER_H
@@ -0,0 +1,41 @@
+#include "uniformbuffer.h"
+
+UniformBuffer::UniformBuffer() : handle(0), binding(0), size(0) { }
+
+UniformBuffer::~UniformBuffer()
+{
+    if( handle != 0 )
+        glDeleteBuffers(1, &handle);
+}
+
+void UniformBuffer::create( GLsizeiptr size, GLuint binding, const void * data )
+{
+    this->size = size;
+    this->binding = binding;
+
+    if( handle == 0 )
+        glGenBuffers(1, &handle);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, handle);
+    glBufferData(GL_UNIFORM_BUFFER, size, data, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, handle);
+}
+
+void UniformBuffer::update( const void * data, GLsizeiptr size, GLintptr offset )
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, handle);
+    glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+GLuint UniformBuffer::getHandle()
+{
+    return handle;
+}
+
+GLuint UniformBuffer::getBinding()
+{
+    return binding;
+}
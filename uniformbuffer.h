@@ -0,0 +1,39 @@
+#ifndef UNIFORMBUFFER_H
+#define UNIFORMBUFFER_H
+
+#include "cookbookogl.h"
+
+// Binding points shared by every program. A program's uniform block is
+// attached to one of these with GLSLProgram::bindUniformBlock.
+namespace UniformBlock {
+  enum Binding {
+    CAMERA = 0,
+    LIGHTS = 1
+  };
+};
+
+// A uniform buffer object bound to a fixed binding point. The contents
+// are expected to follow the std140 layout of the matching GLSL block.
+class UniformBuffer
+{
+  private:
+    GLuint handle;
+    GLuint binding;
+    GLsizeiptr size;
+
+    // Non-copyable
+    UniformBuffer( const UniformBuffer & other ) { }
+    UniformBuffer & operator=( const UniformBuffer &other ) { return *this; }
+
+  public:
+    UniformBuffer();
+    ~UniformBuffer();
+
+    void   create( GLsizeiptr size, GLuint binding, const void * data = NULL );
+    void   update( const void * data, GLsizeiptr size, GLintptr offset = 0 );
+
+    GLuint getHandle();
+    GLuint getBinding();
+};
+
+#endif // UNIFORMBUFFER_H
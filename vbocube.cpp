@@ -2,12 +2,14 @@
 
 #include "cookbookogl.h"
 #include "glutils.h"
+#include "vertexpacking.h"
 
 #include <cstdio>
 
 VBOCube::VBOCube()
-{// TODO (aklaum#1#): Need to modify this so that it winds properly.  OpenGL is assuming that the top is the back and culling makes it invisible.
-
+{
+// TODO (aklaum#1#): Need to modify this so that it winds properly.  OpenGL is assuming that the top is the back and culling makes it invisible.
+
     float side = 1.0f;
     float side2 = side / 2.0f;
 
@@ -123,30 +125,50 @@ VBOCube::VBOCube()
     glBindVertexArray(vaoHandle);
 
     unsigned int handle[4];
-    glGenBuffers(4, handle);
+    if( VertexPacking::isEnabled() && VertexPacking::canPackPositions(v, 24) ) {
+        // One interleaved vertex buffer and the indices
+        glGenBuffers(2, handle);
+        VertexPacking::uploadVertices(handle[0], v, n, tex, 24);
+        indexType = VertexPacking::uploadIndices(handle[1], el, 36, 24);
+    } else {
+        indexType = GL_UNSIGNED_INT;
+        glGenBuffers(4, handle);
 
-    glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
-    glBufferData(GL_ARRAY_BUFFER, 24 * 3 * sizeof(float), v, GL_STATIC_DRAW);
-    glVertexAttribPointer( (GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(0);  // Vertex position
+        glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
+        glBufferData(GL_ARRAY_BUFFER, 24 * 3 * sizeof(float), v, GL_STATIC_DRAW);
+        glVertexAttribPointer( (GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
+        glEnableVertexAttribArray(0);  // Vertex position
 
-    glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
-    glBufferData(GL_ARRAY_BUFFER, 24 * 3 * sizeof(float), n, GL_STATIC_DRAW);
-    glVertexAttribPointer( (GLuint)1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(1);  // Vertex normal
+        glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
+        glBufferData(GL_ARRAY_BUFFER, 24 * 3 * sizeof(float), n, GL_STATIC_DRAW);
+        glVertexAttribPointer( (GLuint)1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
+        glEnableVertexAttribArray(1);  // Vertex normal
 
-    glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
-    glBufferData(GL_ARRAY_BUFFER, 24 * 2 * sizeof(float), tex, GL_STATIC_DRAW);
-    glVertexAttribPointer( (GLuint)2, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(2);  // texture coords
+        glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
+        glBufferData(GL_ARRAY_BUFFER, 24 * 2 * sizeof(float), tex, GL_STATIC_DRAW);
+        glVertexAttribPointer( (GLuint)2, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
+        glEnableVertexAttribArray(2);  // texture coords
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 36 * sizeof(GLuint), el, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, 36 * sizeof(GLuint), el, GL_STATIC_DRAW);
+    }
 
     glBindVertexArray(0);
 }
 
 void VBOCube::render() {
     glBindVertexArray(vaoHandle);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    glDrawElements(GL_TRIANGLES, 36, indexType, ((GLubyte *)NULL + (0)));
+}
+
+unsigned int VBOCube::getVertexArrayHandle() const {
+    return vaoHandle;
+}
+
+int VBOCube::getIndexCount() const {
+    return 36;
+}
+
+unsigned int VBOCube::getIndexType() const {
+    return indexType;
 }
@@ -6,11 +6,17 @@ class VBOCube
 
 private:
     unsigned int vaoHandle;
+    unsigned int indexType;
 
 public:
     VBOCube();
 
     void render();
+
+    // What render() draws, for callers that issue the draw themselves
+    unsigned int getVertexArrayHandle() const;
+    int getIndexCount() const;
+    unsigned int getIndexType() const;
 };
 
 #endif // VBOCUBE_H
@@ -2,13 +2,14 @@
 #include "glutils.h"
 
 #include "cookbookogl.h"
+#include "vertexpacking.h"
 
 #include "glutils.h"
 
 #include <cstdio>
-#include <cmath>
-#include <iostream>
-
+#include <cmath>
+#include <iostream>
+
 using namespace std;
 
 VBOPlane::VBOPlane(float xsize, float zsize, int xdivs, int zdivs, float smax, float tmax)
@@ -59,60 +60,69 @@ VBOPlane::VBOPlane(float xsize, float zsize, int xdivs, int zdivs, float smax, f
             el[idx+5] = rowStart + j + 1;
             idx += 6;
         }
-    }
-
-    unsigned int handle[4];
-    glGenBuffers(4, handle);
+    }
 
 	glGenVertexArrays( 1, &vaoHandle );
     glBindVertexArray(vaoHandle);
 
-    glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
-    glBufferData(GL_ARRAY_BUFFER, 3 * (xdivs+1) * (zdivs+1) * sizeof(float), v, GL_STATIC_DRAW);
-    glVertexAttribPointer( (GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(0);  // Vertex position
-
-	glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
-    glBufferData(GL_ARRAY_BUFFER, 3 * (xdivs+1) * (zdivs+1) * sizeof(float), n, GL_STATIC_DRAW);
-    glVertexAttribPointer( (GLuint)1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(1);  // Vertex normal
-
-    glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
-    glBufferData(GL_ARRAY_BUFFER, 2 * (xdivs+1) * (zdivs+1) * sizeof(float), tex, GL_STATIC_DRAW);
-    glVertexAttribPointer( (GLuint)2, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-    glEnableVertexAttribArray(2);  // Texture coords
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * xdivs * zdivs * sizeof(unsigned int), el, GL_STATIC_DRAW);
-
-    glBindVertexArray(0);
-
-    cout << "Vertex Array" << endl;
-    for(int i=0; i < (3 * (xdivs + 1) * (zdivs + 1)); ++i) {
-        cout << v[i] << " ";
-        if((i + 1) % 3 == 0 && i > 0)
-            cout << endl;
-    }
-
-    cout << "Normal Array" << endl;
-    for(int i=0; i < (3 * (xdivs + 1) * (zdivs + 1)); ++i) {
-        cout << n[i] << " ";
-        if((i + 1) % 3 == 0 && i > 0)
-            cout << endl;
-    }
-
-    cout << "Texture Array" << endl;
-    for(int i=0; i < (2 * (xdivs + 1) * (zdivs + 1)); ++i) {
-        cout << v[i] << " ";
-        if((i + 1) % 2 == 0 && i > 0)
-            cout << endl;
-    }
-
-    cout << "Index Array" << endl;
-    for(int i=0; i < (6 * xdivs * zdivs); ++i) {
-        cout << el[i] << " ";
-        if((i + 1) % 3 == 0 && i > 0)
-            cout << endl;
+    unsigned int handle[4];
+    if( VertexPacking::isEnabled() && VertexPacking::canPackPositions(v, (xdivs+1) * (zdivs+1)) ) {
+        // One interleaved vertex buffer and the indices
+        glGenBuffers(2, handle);
+        int nVerts = (xdivs+1) * (zdivs+1);
+        VertexPacking::uploadVertices(handle[0], v, n, tex, nVerts);
+        indexType = VertexPacking::uploadIndices(handle[1], el, 6 * xdivs * zdivs, nVerts);
+    } else {
+        indexType = GL_UNSIGNED_INT;
+        glGenBuffers(4, handle);
+
+        glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
+        glBufferData(GL_ARRAY_BUFFER, 3 * (xdivs+1) * (zdivs+1) * sizeof(float), v, GL_STATIC_DRAW);
+        glVertexAttribPointer( (GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
+        glEnableVertexAttribArray(0);  // Vertex position
+
+        glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
+        glBufferData(GL_ARRAY_BUFFER, 3 * (xdivs+1) * (zdivs+1) * sizeof(float), n, GL_STATIC_DRAW);
+        glVertexAttribPointer( (GLuint)1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
+        glEnableVertexAttribArray(1);  // Vertex normal
+
+        glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
+        glBufferData(GL_ARRAY_BUFFER, 2 * (xdivs+1) * (zdivs+1) * sizeof(float), tex, GL_STATIC_DRAW);
+        glVertexAttribPointer( (GLuint)2, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
+        glEnableVertexAttribArray(2);  // Texture coords
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * xdivs * zdivs * sizeof(unsigned int), el, GL_STATIC_DRAW);
+    }
+
+    glBindVertexArray(0);
+
+    cout << "Vertex Array" << endl;
+    for(int i=0; i < (3 * (xdivs + 1) * (zdivs + 1)); ++i) {
+        cout << v[i] << " ";
+        if((i + 1) % 3 == 0 && i > 0)
+            cout << endl;
+    }
+
+    cout << "Normal Array" << endl;
+    for(int i=0; i < (3 * (xdivs + 1) * (zdivs + 1)); ++i) {
+        cout << n[i] << " ";
+        if((i + 1) % 3 == 0 && i > 0)
+            cout << endl;
+    }
+
+    cout << "Texture Array" << endl;
+    for(int i=0; i < (2 * (xdivs + 1) * (zdivs + 1)); ++i) {
+        cout << v[i] << " ";
+        if((i + 1) % 2 == 0 && i > 0)
+            cout << endl;
+    }
+
+    cout << "Index Array" << endl;
+    for(int i=0; i < (6 * xdivs * zdivs); ++i) {
+        cout << el[i] << " ";
+        if((i + 1) % 3 == 0 && i > 0)
+            cout << endl;
     }
 
     delete [] v;
@@ -124,6 +134,18 @@ VBOPlane::VBOPlane(float xsize, float zsize, int xdivs, int zdivs, float smax, f
 void VBOPlane::render() const {
     GLUtils::checkForOpenGLError(__FILE__,__LINE__);
     glBindVertexArray(vaoHandle);
-    glDrawElements(GL_TRIANGLES, 6 * faces, GL_UNSIGNED_INT, nullptr);
+    glDrawElements(GL_TRIANGLES, 6 * faces, indexType, nullptr);
     GLUtils::checkForOpenGLError(__FILE__,__LINE__);
 }
+
+unsigned int VBOPlane::getVertexArrayHandle() const {
+    return vaoHandle;
+}
+
+int VBOPlane::getIndexCount() const {
+    return 6 * faces;
+}
+
+unsigned int VBOPlane::getIndexType() const {
+    return indexType;
+}
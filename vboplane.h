@@ -8,11 +8,17 @@ class VBOPlane : public Drawable
 private:
     unsigned int vaoHandle;
     int faces;
+    unsigned int indexType;
 
 public:
     VBOPlane(float, float, int, int, float smax = 1.0f, float tmax = 1.0f);
 
     void render() const;
+
+    // What render() draws, for callers that issue the draw themselves
+    unsigned int getVertexArrayHandle() const;
+    int getIndexCount() const;
+    unsigned int getIndexType() const;
 };
 
 #endif // VBOPLANE_H
@@ -2,6 +2,7 @@
 #include "cookbookogl.h"
 
 #include "glutils.h"
+#include "vertexpacking.h"
 
 #include <cstdio>
 #include <cmath>
@@ -26,51 +27,50 @@ VBOTorus::VBOTorus(float outerRadius, float innerRadius, int nsides, int nrings)
     // Generate the vertex data
     generateVerts(v, n, tex, el, outerRadius, innerRadius);
 
-    // Create and populate the buffer objects
-    unsigned int handle[4];
-    glGenBuffers(4, handle);
-
-    glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), v, GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
-    glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), n, GL_STATIC_DRAW);
+    // Create the VAO and populate the buffer objects
+    glGenVertexArrays( 1, &vaoHandle );
+    glBindVertexArray(vaoHandle);
 
-    glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
-    glBufferData(GL_ARRAY_BUFFER, (2 * nVerts) * sizeof(float), tex, GL_STATIC_DRAW);
+    unsigned int handle[4];
+    if( VertexPacking::isEnabled() && VertexPacking::canPackPositions(v, nVerts) ) {
+        // One interleaved vertex buffer and the indices
+        glGenBuffers(2, handle);
+        VertexPacking::uploadVertices(handle[0], v, n, tex, nVerts);
+        indexType = VertexPacking::uploadIndices(handle[1], el, 6 * faces, nVerts);
+    } else {
+        indexType = GL_UNSIGNED_INT;
+        glGenBuffers(4, handle);
+
+        glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
+        glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), v, GL_STATIC_DRAW);
+        glVertexAttribPointer( (GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
+        glEnableVertexAttribArray(0);  // Vertex position
+
+        glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
+        glBufferData(GL_ARRAY_BUFFER, (3 * nVerts) * sizeof(float), n, GL_STATIC_DRAW);
+        glVertexAttribPointer( (GLuint)1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
+        glEnableVertexAttribArray(1);  // Vertex normal
+
+        glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
+        glBufferData(GL_ARRAY_BUFFER, (2 * nVerts) * sizeof(float), tex, GL_STATIC_DRAW);
+        glVertexAttribPointer( (GLuint)2, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
+        glEnableVertexAttribArray(2);  // Texture coords
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * faces * sizeof(unsigned int), el, GL_STATIC_DRAW);
+    }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 6 * faces * sizeof(unsigned int), el, GL_STATIC_DRAW);
+    glBindVertexArray(0);
 
     delete [] v;
     delete [] n;
     delete [] el;
     delete [] tex;
-
-    // Create the VAO
-    glGenVertexArrays( 1, &vaoHandle );
-    glBindVertexArray(vaoHandle);
-
-    glEnableVertexAttribArray(0);  // Vertex position
-    glBindBuffer(GL_ARRAY_BUFFER, handle[0]);
-    glVertexAttribPointer( (GLuint)0, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-
-    glEnableVertexAttribArray(1);  // Vertex normal
-    glBindBuffer(GL_ARRAY_BUFFER, handle[1]);
-    glVertexAttribPointer( (GLuint)1, 3, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-
-    glBindBuffer(GL_ARRAY_BUFFER, handle[2]);
-    glEnableVertexAttribArray(2);  // Texture coords
-    glVertexAttribPointer( (GLuint)2, 2, GL_FLOAT, GL_FALSE, 0, ((GLubyte *)NULL + (0)) );
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle[3]);
-
-    glBindVertexArray(0);
 }
 
 void VBOTorus::render() const {
     glBindVertexArray(vaoHandle);
-    glDrawElements(GL_TRIANGLES, 6 * faces, GL_UNSIGNED_INT, ((GLubyte *)NULL + (0)));
+    glDrawElements(GL_TRIANGLES, 6 * faces, indexType, ((GLubyte *)NULL + (0)));
 }
 
 void VBOTorus::generateVerts(float * verts, float * norms, float * tex,
@@ -133,3 +133,11 @@ int VBOTorus::getVertexArrayHandle() {
 	return this->vaoHandle;
 }
 
+
+int VBOTorus::getIndexCount() const {
+    return 6 * faces;
+}
+
+unsigned int VBOTorus::getIndexType() const {
+    return indexType;
+}
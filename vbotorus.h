@@ -7,6 +7,7 @@ class VBOTorus : public Drawable
 {
 private:
     unsigned int vaoHandle;
+    unsigned int indexType;
     int faces, rings, sides;
 
     void generateVerts(float * , float * ,float *, unsigned int *,
@@ -18,6 +19,8 @@ public:
     void render() const;
 
 	int getVertexArrayHandle();
+    int getIndexCount() const;
+    unsigned int getIndexType() const;
 };
 
 #endif // VBOTORUS_H
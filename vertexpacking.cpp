@@ -0,0 +1,115 @@
+#include "vertexpacking.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+namespace {
+    bool packingEnabled = false;
+
+    // Largest coordinate a packed position may have
+    const float MAX_HALF_POSITION = 2048.0f;
+}
+
+void VertexPacking::setEnabled( bool enabled )
+{
+    packingEnabled = enabled;
+}
+
+bool VertexPacking::isEnabled()
+{
+    return packingEnabled;
+}
+
+bool VertexPacking::canPackPositions( const float * positions, GLsizei count, GLsizei stride )
+{
+    if( count == 0 )
+        return true;
+
+    glm::vec3 lower(positions[0], positions[1], positions[2]);
+    glm::vec3 upper = lower;
+    for( GLsizei i = 1; i < count; ++i ) {
+        glm::vec3 p(positions[i * stride], positions[i * stride + 1], positions[i * stride + 2]);
+        lower = glm::min(lower, p);
+        upper = glm::max(upper, p);
+    }
+
+    glm::vec3 magnitude = glm::max(glm::abs(lower), glm::abs(upper));
+    float largest = glm::max(magnitude.x, glm::max(magnitude.y, magnitude.z));
+    if( largest >= MAX_HALF_POSITION )
+        return false;
+
+    // A half float has 10 fraction bits, so it rounds by at most half of
+    // 2^(exponent - 10), and never less finely than its subnormal step
+    glm::vec3 size = upper - lower;
+    float extent = glm::max(size.x, glm::max(size.y, size.z));
+    int exponent = largest > 0.0f ? (int)floorf(log2f(largest)) : -14;
+    float error = 0.5f * ldexpf(1.0f, glm::max(exponent, -14) - 10);
+    return error <= extent / 1024.0f;
+}
+
+PackedVertex VertexPacking::pack( const float * position, const float * normal,
+                                  const float * texCoord )
+{
+    PackedVertex packed;
+
+    // packHalf4x16 puts x in the low bits, which is the first ushort in memory
+    GLuint64 halfPosition = glm::packHalf4x16(glm::vec4(position[0], position[1],
+                                                           position[2], 1.0f));
+    memcpy(packed.position, &halfPosition, sizeof(packed.position));
+
+    // packSnorm3x10_1x2 matches the GL_INT_2_10_10_10_REV bit layout
+    packed.normal = glm::packSnorm3x10_1x2(glm::vec4(normal[0], normal[1], normal[2], 0.0f));
+
+    GLuint halfTexCoord = glm::packHalf2x16(glm::vec2(texCoord[0], texCoord[1]));
+    memcpy(packed.texCoord, &halfTexCoord, sizeof(packed.texCoord));
+
+    return packed;
+}
+
+void VertexPacking::uploadVertices( GLuint buffer, const float * positions, const float * normals,
+                                    const float * texCoords, GLsizei count )
+{
+    std::vector<PackedVertex> packed(count);
+    for( GLsizei i = 0; i < count; ++i )
+        packed[i] = pack(positions + 3 * i, normals + 3 * i, texCoords + 2 * i);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(PackedVertex), &packed[0], GL_STATIC_DRAW);
+    setAttributes();
+}
+
+void VertexPacking::setAttributes()
+{
+    glVertexAttribPointer( (GLuint)0, 4, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex),
+                           (GLvoid *)offsetof(PackedVertex, position) );
+    glEnableVertexAttribArray(0);  // Vertex position
+
+    glVertexAttribPointer( (GLuint)1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex),
+                           (GLvoid *)offsetof(PackedVertex, normal) );
+    glEnableVertexAttribArray(1);  // Vertex normal
+
+    glVertexAttribPointer( (GLuint)2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex),
+                           (GLvoid *)offsetof(PackedVertex, texCoord) );
+    glEnableVertexAttribArray(2);  // Texture coords
+}
+
+GLenum VertexPacking::uploadIndices( GLuint buffer, const GLuint * indices, GLsizei count,
+                                     GLsizei vertexCount )
+{
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+
+    if( vertexCount > 65536 ) {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(GLuint), indices, GL_STATIC_DRAW);
+        return GL_UNSIGNED_INT;
+    }
+
+    std::vector<GLushort> shortIndices(indices, indices + count);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(GLushort),
+                 shortIndices.empty() ? NULL : &shortIndices[0], GL_STATIC_DRAW);
+    return GL_UNSIGNED_SHORT;
+}
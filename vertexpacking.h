@@ -0,0 +1,48 @@
+#ifndef VERTEXPACKING_H
+#define VERTEXPACKING_H
+
+#include "cookbookogl.h"
+
+// Compact interleaved vertex, 16 bytes instead of 32 for three float
+// streams. Every component is in a format the vertex fetch converts on its
+// own, so the shaders still see vec3 position, vec3 normal and vec2 UV:
+//   position  4 x half float (w = 1)
+//   normal    GL_INT_2_10_10_10_REV, normalized
+//   texCoord  2 x half float
+// Half float positions only suit meshes near the origin for their size,
+// see canPackPositions; the others keep the float layout.
+struct PackedVertex {
+    GLushort position[4];
+    GLuint   normal;
+    GLushort texCoord[2];
+};
+
+namespace VertexPacking
+{
+    // Whether meshes and the VBO primitives use the packed layout. Read when
+    // their buffers are created, so set it before loading anything.
+    void setEnabled( bool enabled );
+    bool isEnabled();
+
+    // Whether half floats hold every position of a mesh closely enough: below
+    // 2048 in magnitude, so whole units stay exact, and off by no more than
+    // 1/1024 of the mesh's extent. stride is in floats.
+    bool canPackPositions( const float * positions, GLsizei count, GLsizei stride = 3 );
+
+    PackedVertex pack( const float * position, const float * normal, const float * texCoord );
+
+    // Packs separate position/normal/texCoord streams into buffer and points
+    // attributes 0-2 of the bound VAO at it
+    void uploadVertices( GLuint buffer, const float * positions, const float * normals,
+        const float * texCoords, GLsizei count );
+
+    // Attribute 0-2 setup for PackedVertex data in the bound GL_ARRAY_BUFFER
+    void setAttributes();
+
+    // Uploads indices to the bound VAO's element buffer, as 16 bit values when
+    // every vertex fits. Returns the index type to draw with.
+    GLenum uploadIndices( GLuint buffer, const GLuint * indices, GLsizei count,
+        GLsizei vertexCount );
+}
+
+#endif // VERTEXPACKING_H